@@ -0,0 +1,115 @@
+-- Optional stored procedure that lets clients claim jobs in a single round trip to the database.
+-- Clients use it if it exists in the EDACC database, otherwise they claim jobs with several queries.
+--
+--   mysql -u <user> -p <database> < claim_jobs.sql
+--
+-- The jobs are claimed like db_fetch_jobs() does: highest priority first, jobs whose instance or
+-- solver binary the client has locally first, otherwise starting at a random job id of the priority
+-- level. Each claimed job is returned as a result set of one row. Like in LOCK_JOB, the start time
+-- is set by the client when it actually starts the job. Only jobs that finish within maxRuntime
+-- seconds and whose memory limit is at most maxMemory MB are claimed (-1 for no restriction).
+--
+-- The priority levels are read once from the index in indexes.sql alone. The conditions are only
+-- checked by the UPDATEs, which scan the index of a level from the start id until a job fits.
+-- The solver binaries are passed as comma separated lists of the ids of their solver configs
+-- (solverConfigIds restricts the jobs, '' for any solver binary; cachedSolverConfigIds and
+-- instanceIds are the locally available ones), so the UPDATEs only compare columns of ExperimentResults.
+
+DELIMITER //
+
+DROP PROCEDURE IF EXISTS claimJobs//
+CREATE PROCEDURE claimJobs(IN clientId INT, IN gridQueueId INT, IN experimentId INT, IN solverConfigIds TEXT,
+                           IN numJobs INT, IN maxRuntime INT, IN maxMemory INT, IN node VARCHAR(255),
+                           IN nodeIP VARCHAR(255), IN instanceIds TEXT, IN cachedSolverConfigIds TEXT)
+    MODIFIES SQL DATA
+BEGIN
+    DECLARE claimed INT DEFAULT 0;
+    DECLARE updated INT;
+    DECLARE levelPriority INT;
+    DECLARE startId INT;
+    DECLARE cachedLeft INT;
+    DECLARE done INT DEFAULT 0;
+    DECLARE conditions TEXT DEFAULT '';
+    DECLARE cachedCondition TEXT DEFAULT '';
+    DECLARE levels CURSOR FOR
+        SELECT priority, FLOOR(MIN(idJob) + RAND() * (MAX(idJob) - MIN(idJob) + 1))
+            FROM ExperimentResults
+            WHERE Experiment_idExperiment = experimentId AND status = -1 AND priority >= 0
+            GROUP BY priority ORDER BY priority DESC;
+    DECLARE CONTINUE HANDLER FOR NOT FOUND SET done = 1;
+
+    -- the id lists become part of the statements
+    IF CONCAT(solverConfigIds, ',', instanceIds, ',', cachedSolverConfigIds) NOT REGEXP '^[0-9,]*$' THEN
+        SIGNAL SQLSTATE '45000' SET MESSAGE_TEXT = 'claimJobs: the id lists may only contain ids';
+    END IF;
+    IF solverConfigIds <> '' THEN
+        SET conditions = CONCAT(conditions, ' AND SolverConfig_idSolverConfig IN (', solverConfigIds, ')');
+    END IF;
+    IF maxRuntime >= 0 THEN
+        SET conditions = CONCAT(conditions, ' AND IF(wallClockTimeLimit > 0, wallClockTimeLimit, CPUTimeLimit) BETWEEN 1 AND ', maxRuntime);
+    END IF;
+    IF maxMemory >= 0 THEN
+        SET conditions = CONCAT(conditions, ' AND IFNULL(memoryLimit, 0) <= ', maxMemory);
+    END IF;
+    IF instanceIds <> '' AND cachedSolverConfigIds <> '' THEN
+        SET cachedCondition = CONCAT(' AND (Instances_idInstance IN (', instanceIds, ') OR SolverConfig_idSolverConfig IN (',
+                                     cachedSolverConfigIds, '))');
+    ELSEIF instanceIds <> '' THEN
+        SET cachedCondition = CONCAT(' AND Instances_idInstance IN (', instanceIds, ')');
+    ELSEIF cachedSolverConfigIds <> '' THEN
+        SET cachedCondition = CONCAT(' AND SolverConfig_idSolverConfig IN (', cachedSolverConfigIds, ')');
+    END IF;
+
+    SET @claimUpdate = 'UPDATE ExperimentResults SET status = 0, startTime = NULL, computeQueue = ?, computeNode = ?, '
+                       'computeNodeIP = ?, Client_idClient = ?, idJob = LAST_INSERT_ID(idJob) '
+                       'WHERE Experiment_idExperiment = ? AND status = -1 AND priority = ?';
+    SET @claimCached = CONCAT(@claimUpdate, conditions, cachedCondition, ' LIMIT 1');
+    SET @claimFrom = CONCAT(@claimUpdate, conditions, ' AND idJob >= ? ORDER BY idJob LIMIT 1');
+    SET @claimBefore = CONCAT(@claimUpdate, conditions, ' AND idJob < ? ORDER BY idJob LIMIT 1');
+    PREPARE claimCached FROM @claimCached;
+    PREPARE claimFrom FROM @claimFrom;
+    PREPARE claimBefore FROM @claimBefore;
+    SET @gridQueueId = gridQueueId, @node = node, @nodeIP = nodeIP, @clientId = clientId, @experimentId = experimentId;
+
+    OPEN levels;
+    level: LOOP
+        FETCH levels INTO levelPriority, startId;
+        IF done = 1 OR claimed >= numJobs THEN
+            LEAVE level;
+        END IF;
+        SET @levelPriority = levelPriority, @startId = startId;
+        SET cachedLeft = cachedCondition <> '';
+        claim: WHILE claimed < numJobs DO
+            SET updated = 0;
+            IF cachedLeft THEN
+                EXECUTE claimCached USING @gridQueueId, @node, @nodeIP, @clientId, @experimentId, @levelPriority;
+                SET updated = ROW_COUNT();
+                SET cachedLeft = updated > 0;
+            END IF;
+            IF updated = 0 THEN
+                EXECUTE claimFrom USING @gridQueueId, @node, @nodeIP, @clientId, @experimentId, @levelPriority, @startId;
+                SET updated = ROW_COUNT();
+            END IF;
+            IF updated = 0 THEN
+                EXECUTE claimBefore USING @gridQueueId, @node, @nodeIP, @clientId, @experimentId, @levelPriority, @startId;
+                SET updated = ROW_COUNT();
+            END IF;
+            -- no job of the level fits or all of them were taken by other clients meanwhile
+            IF updated = 0 THEN
+                LEAVE claim;
+            END IF;
+
+            SET claimed = claimed + 1;
+            SELECT idJob, SolverConfig_idSolverConfig, Experiment_idExperiment, Instances_idInstance, run, seed, priority,
+                   CPUTimeLimit, wallClockTimeLimit, memoryLimit, stackSizeLimit
+                FROM ExperimentResults WHERE idJob = LAST_INSERT_ID();
+        END WHILE;
+    END LOOP;
+    CLOSE levels;
+
+    DEALLOCATE PREPARE claimCached;
+    DEALLOCATE PREPARE claimFrom;
+    DEALLOCATE PREPARE claimBefore;
+END//
+
+DELIMITER ;
@@ -0,0 +1,13 @@
+-- Indexes the client's queries rely on. Without them claiming jobs, handing back expired leases
+-- and predicting run times read all jobs of an experiment.
+--
+--   mysql -u <user> -p <database> < indexes.sql
+--
+-- The unprocessed, running and leased jobs of an experiment by priority, used by db_fetch_jobs(),
+-- the claimJobs procedure (claim_jobs.sql) and db_reclaim_leases().
+CREATE INDEX idx_claim ON ExperimentResults (Experiment_idExperiment, status, priority, idJob);
+
+-- The finished runs of an instance in an experiment by solver config, used by get_runtime_history()
+-- for the run time predictions of the prefetch thread.
+CREATE INDEX idx_history ON ExperimentResults (Experiment_idExperiment, Instances_idInstance, SolverConfig_idSolverConfig,
+                                               status, resultTime);
@@ -0,0 +1,252 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include "cgroup.h"
+#include "log.h"
+
+using namespace std;
+
+#ifndef CGROUP2_SUPER_MAGIC
+#define CGROUP2_SUPER_MAGIC 0x63677270
+#endif
+
+// period (us) of the CPU bandwidth limit (cpu.max)
+const int CPU_MAX_PERIOD = 100000;
+
+/**
+ * Each job gets its own cgroup v2 below a delegated parent cgroup. The cgroup limits
+ * the memory and CPU bandwidth of the job, pins it to its CPUs, accounts its resource usage
+ * and is used to kill all processes of the job at once.
+ */
+
+static bool write_file(const string& filename, const string& value) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    bool ok = write(fd, value.c_str(), value.length()) == (ssize_t)value.length();
+    int err = errno;
+    close(fd);
+    errno = err;
+    return ok;
+}
+
+static string join_set(const set<int>& ids) {
+    ostringstream oss;
+    for (set<int>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+        if (it != ids.begin()) oss << ',';
+        oss << *it;
+    }
+    return oss.str();
+}
+
+static bool file_exists(const string& filename) {
+    return access(filename.c_str(), F_OK) == 0;
+}
+
+/**
+ * Enables the controllers used for the jobs in <code>parent</code>, which has to be a
+ * cgroup v2 directory the client may write to (e.g. delegated by systemd). If the client
+ * itself is a member of <code>parent</code>, it is moved to the leaf cgroup
+ * <code>parent/client</code> first because cgroups with processes can't enable controllers
+ * for their children. Empty job cgroups left behind by a previous client are removed.
+ *
+ * @param parent the parent cgroup of the job cgroups
+ * @return true on success, false if <code>parent</code> can't be used
+ */
+bool cgroup_init(const string& parent) {
+    struct statfs fs;
+    if (statfs(parent.c_str(), &fs) != 0 || fs.f_type != CGROUP2_SUPER_MAGIC) {
+        log_error(AT, "%s is not a cgroup v2 directory", parent.c_str());
+        return false;
+    }
+    ifstream controllers_file((parent + "/cgroup.controllers").c_str());
+    set<string> available;
+    string controller;
+    while (controllers_file >> controller) {
+        available.insert(controller);
+    }
+    const char* wanted[] = {"cpu", "cpuset", "memory", "io"};
+    string enabled;
+    for (unsigned int i = 0; i < sizeof(wanted) / sizeof(wanted[0]); i++) {
+        if (available.count(wanted[i]) == 0) {
+            continue;
+        }
+        string value = string("+") + wanted[i];
+        bool ok = write_file(parent + "/cgroup.subtree_control", value);
+        if (!ok && errno == EBUSY) {
+            // the client is a member of the parent cgroup
+            string client_cgroup = parent + "/client";
+            ostringstream pid;
+            pid << getpid();
+            if ((mkdir(client_cgroup.c_str(), 0755) == 0 || errno == EEXIST)
+                    && write_file(client_cgroup + "/cgroup.procs", pid.str())) {
+                log_message(LOG_INFO, "Moved the client to cgroup %s", client_cgroup.c_str());
+                ok = write_file(parent + "/cgroup.subtree_control", value);
+            }
+        }
+        if (ok) {
+            enabled += string(" ") + wanted[i];
+        } else {
+            log_message(LOG_IMPORTANT, "WARNING: Could not enable cgroup controller %s in %s: %s",
+                        wanted[i], parent.c_str(), strerror(errno));
+        }
+    }
+    DIR* dir = opendir(parent.c_str());
+    if (dir != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strncmp(entry->d_name, "job", 3) == 0 && rmdir((parent + "/" + entry->d_name).c_str()) == 0) {
+                log_message(LOG_DEBUG, "Removed cgroup %s/%s of a previous client", parent.c_str(), entry->d_name);
+            }
+        }
+        closedir(dir);
+    }
+    if (available.count("memory") == 0) {
+        log_message(LOG_IMPORTANT, "WARNING: memory controller not available in %s, memory limits are not enforced by the cgroups.", parent.c_str());
+    }
+    log_message(LOG_IMPORTANT, "Running jobs in cgroups below %s, controllers:%s", parent.c_str(), enabled.c_str());
+    return true;
+}
+
+/**
+ * Creates the cgroup <code>path</code> for the job (or reuses it) and sets its limits:
+ * memory.max to the memory limit of the job (swap is disabled then), cpu.max to the number
+ * of CPUs of the job, cpuset.cpus to <code>cpu_ids</code> and cpuset.mems to
+ * <code>numa_nodes</code>. Limits of controllers that aren't enabled are skipped.
+ *
+ * @param path the cgroup of the job
+ * @param job the job that is started
+ * @param cpu_ids the processing units of the job, empty if it isn't pinned
+ * @param numa_nodes the NUMA nodes of the job, empty if its memory isn't bound
+ * @return a file descriptor of cgroup.procs that the job is moved into the cgroup with,
+ *         see spawn_process(); -1 on errors
+ */
+int cgroup_prepare(const string& path, const Job& job, const set<int>& cpu_ids,
+                   const set<int>& numa_nodes) {
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+        log_error(AT, "Could not create cgroup %s: %s", path.c_str(), strerror(errno));
+        return -1;
+    }
+    if (file_exists(path + "/memory.max")) {
+        ostringstream memory_max;
+        if (job.memoryLimit > 0) {
+            memory_max << (long long)job.memoryLimit * 1024 * 1024;
+        } else {
+            memory_max << "max";
+        }
+        if (!write_file(path + "/memory.max", memory_max.str())) {
+            log_error(AT, "Could not set memory.max of cgroup %s", path.c_str());
+        }
+        if (file_exists(path + "/memory.swap.max")) {
+            write_file(path + "/memory.swap.max", job.memoryLimit > 0 ? "0" : "max");
+        }
+    }
+    if (file_exists(path + "/cpu.max")) {
+        ostringstream cpu_max;
+        cpu_max << job.numCPUs * CPU_MAX_PERIOD << " " << CPU_MAX_PERIOD;
+        if (!write_file(path + "/cpu.max", cpu_max.str())) {
+            log_error(AT, "Could not set cpu.max of cgroup %s", path.c_str());
+        }
+    }
+    // an empty cpuset uses the CPUs and nodes of the parent
+    if (file_exists(path + "/cpuset.cpus") && !write_file(path + "/cpuset.cpus", join_set(cpu_ids))) {
+        log_error(AT, "Could not set cpuset.cpus of cgroup %s", path.c_str());
+    }
+    if (file_exists(path + "/cpuset.mems") && !write_file(path + "/cpuset.mems", join_set(numa_nodes))) {
+        log_error(AT, "Could not set cpuset.mems of cgroup %s", path.c_str());
+    }
+    int fd = open((path + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        log_error(AT, "Could not open cgroup.procs of cgroup %s: %s", path.c_str(), strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * Kills all processes of the cgroup <code>path</code> with cgroup.kill. Kernels before 5.14
+ * don't have it, then SIGKILL is sent to the processes listed in cgroup.procs.
+ *
+ * @param path the cgroup
+ * @return true on success
+ */
+bool cgroup_kill(const string& path) {
+    if (write_file(path + "/cgroup.kill", "1")) {
+        return true;
+    }
+    ifstream procs((path + "/cgroup.procs").c_str());
+    if (!procs) {
+        return false;
+    }
+    pid_t pid;
+    while (procs >> pid) {
+        kill(pid, SIGKILL);
+    }
+    return true;
+}
+
+/**
+ * Reads the resource usage of the processes of the cgroup <code>path</code>.
+ *
+ * @param path the cgroup
+ * @param stats where the usage is stored
+ * @return true on success, false if cpu.stat couldn't be read
+ */
+bool cgroup_read_stats(const string& path, CgroupStats& stats) {
+    ifstream cpu_stat((path + "/cpu.stat").c_str());
+    if (!cpu_stat) {
+        return false;
+    }
+    string key;
+    long long value;
+    while (cpu_stat >> key >> value) {
+        if (key == "usage_usec") stats.cpu_time = value / 1e6;
+        else if (key == "user_usec") stats.user_time = value / 1e6;
+        else if (key == "system_usec") stats.system_time = value / 1e6;
+    }
+    ifstream memory_peak((path + "/memory.peak").c_str());
+    if (memory_peak) {
+        memory_peak >> stats.memory_peak;
+    }
+    ifstream memory_events((path + "/memory.events").c_str());
+    while (memory_events >> key >> value) {
+        if (key == "oom_kill") stats.oom_kills = (int)value;
+    }
+    // one line per device: "8:0 rbytes=1 wbytes=2 rios=3 wios=4 dbytes=0 dios=0"
+    ifstream io_stat((path + "/io.stat").c_str());
+    string token;
+    while (io_stat >> token) {
+        if (token.compare(0, 7, "rbytes=") == 0) stats.io_read_bytes += atoll(token.c_str() + 7);
+        else if (token.compare(0, 7, "wbytes=") == 0) stats.io_write_bytes += atoll(token.c_str() + 7);
+    }
+    return true;
+}
+
+/**
+ * Removes the cgroup <code>path</code> of a finished job. Killed processes may take a moment
+ * to leave the cgroup, so this is retried for up to 0.5 s. It is called by the janitor thread,
+ * see janitor_remove_cgroup().
+ *
+ * @param path the cgroup
+ */
+void cgroup_remove(const string& path) {
+    for (int i = 0; i < 50; i++) {
+        if (rmdir(path.c_str()) == 0 || errno == ENOENT) {
+            return;
+        }
+        if (errno != EBUSY) {
+            break;
+        }
+        usleep(10000);
+    }
+    log_message(LOG_IMPORTANT, "Could not remove cgroup %s: %s", path.c_str(), strerror(errno));
+}
@@ -0,0 +1,32 @@
+#ifndef __cgroup_h__
+#define __cgroup_h__
+
+#include <string>
+#include <set>
+#include "datastructures.h"
+
+/**
+ * Resource usage of a job as accounted by its cgroup.
+ */
+struct CgroupStats {
+    // CPU time (s) from cpu.stat
+    double cpu_time, user_time, system_time;
+    // peak memory usage (bytes) from memory.peak, 0 if the kernel doesn't provide it
+    long long memory_peak;
+    // bytes read and written from io.stat
+    long long io_read_bytes, io_write_bytes;
+    // number of processes killed because of memory.max, from memory.events
+    int oom_kills;
+
+    CgroupStats() : cpu_time(0), user_time(0), system_time(0), memory_peak(0),
+                    io_read_bytes(0), io_write_bytes(0), oom_kills(0) {}
+};
+
+bool cgroup_init(const std::string& parent);
+int cgroup_prepare(const std::string& path, const Job& job, const std::set<int>& cpu_ids,
+                   const std::set<int>& numa_nodes);
+bool cgroup_kill(const std::string& path);
+bool cgroup_read_stats(const std::string& path, CgroupStats& stats);
+void cgroup_remove(const std::string& path);
+
+#endif
@@ -14,9 +14,9 @@
 #include <signal.h>
 #include <sys/stat.h>
 #include <cstring>
-#ifdef use_hwloc
-#include <hwloc.h>
-#endif
+#include <climits>
+#include <map>
+#include <pthread.h>
 
 #include "host_info.h"
 #include "log.h"
@@ -28,6 +28,16 @@
 #include "process.h"
 #include "simulate.h"
 #include "jobserver.h"
+#include "events.h"
+#include "prefetch.h"
+#include "results.h"
+#include "predictor.h"
+#include "watcher.h"
+#include "cgroup.h"
+#include "topology.h"
+#include "perfcounters.h"
+#include "sampler.h"
+#include "janitor.h"
 
 using namespace std;
 
@@ -49,30 +59,46 @@ string cost_binary_download_path;
 // forward declarations
 void print_usage();
 void read_config(string& hostname, string& username, string& password,
-				 string& database, int& port, int& grid_queue_id,
+				 string& database, int& port, vector<int>& grid_queue_ids, vector<int>& grid_queue_weights,
 				 string& jobserver_hostname, int& jobserver_port,
 				 string& sandbox_command, bool& allow_different_solver_binaries);
 void process_jobs(int grid_queue_id);
 int sign_on(int grid_queue_id);
 void sign_off();
 void initialize_workers(GridQueue &grid_queue);
-bool start_job(int grid_queue_id, int solver_binary_id, Worker& worker);
+int claim_jobs(int solver_binary_id, int num_jobs, int max_memory, vector<Job>& jobs);
+int wait_for_jobs(int grid_queue_id, int solver_binary_id, int timeout, int max_memory, vector<Job>& jobs);
+int reclaim_leases(int lease_time);
+bool prepare_job(PreparedJob& prepared_job);
+int start_job(Worker& worker, int max_memory_limit, int max_cpus);
+int get_admissible_memory();
+void reserve_cpus(Worker& worker, const Job& job);
+void release_cpus(Worker& worker);
 int handle_workers(vector<Worker>& workers);
+int check_job_limits();
+double finish_cgroup(Worker& worker);
+void finish_perf_counters(Worker& worker, const struct rusage& usage);
 void signal_handler(int signal);
 string get_solver_output_filename(const Job& job);
 string get_watcher_output_filename(const Job& job);
-string build_watcher_command(const Job& job);
-string build_solver_command(const Job& job, const Solver& solver, const string& solver_base_path, 
-                            const string& instance_binary_filename, const string& tempfiles_path,
-                            const vector<Parameter>& parameters);
+void build_watcher_argv(const Job& job, vector<string>& argv);
+void build_solver_argv(const Job& job, const Solver& solver, const string& solver_base_path,
+                       const string& instance_binary_filename, const string& tempfiles_path,
+                       const vector<Parameter>& parameters, vector<string>& argv);
+void split_words(const string& str, vector<string>& words);
+string join_argv(const vector<string>& argv);
+string join_ids(const set<int>& ids);
 string build_verifier_command(const Verifier& verifier, const string& verifier_base_path,
 							  const string& output_solver, const string& instance, const string& output_watcher,
 							  const string& output_launcher);
 string build_cost_command(const Job& job, const CostBinary& cost_binary, const string& cost_binary_base_path, const string& output_solver, const string& instance);
 int process_results(Job& job);
+void parse_watcher_output(Job& job);
+void finish_job(Job& job, int proc_stat);
 void exit_client(int exitcode, bool wait=false);
 string trim_whitespace(const string& str);
 bool choose_experiment(int grid_queue_id, Experiment &chosen_exp);
+void update_cached_cpu_count(int experiment_id, int delta);
 int find_in_stream(istream &stream, const string tokens);
 string str_lower(const string& str);
 bool parse_watcher_line(istream &stream, const string prefix, float& value);
@@ -82,7 +108,7 @@ static int client_id = -1;
 static string database_name;
 time_t t_started_last_job = time(NULL);
 static vector<Worker> workers;
-static Job downloading_job;
+static Job launching_job;
 static HostInfo host_info; // filled onced on sign on
 static string sandbox_command;
 
@@ -90,7 +116,7 @@ static Methods methods;
 
 // how long to wait for jobs before exiting
 time_t opt_wait_jobs_time = 10;
-// how long to wait between checking for terminated children in ms
+// how long to wait between checking for new jobs in ms if there are idle workers
 static unsigned int opt_check_jobs_interval = 20;
 // whether to keep solver and watcher output after processing or to delete them
 static bool opt_keep_output = false;
@@ -102,6 +128,8 @@ static string opt_base_path;
 static string opt_download_path;
 // the estimated walltime for the client
 static string opt_walltime;
+// monotonic time (s) when the walltime ends minus WALLTIME_MARGIN, 0 if there's no walltime
+static double walltime_deadline = 0;
 // path to config file
 static string opt_config = "./config";
 // whether to exit if the client runs on a system with a different CPU than it is
@@ -111,9 +139,77 @@ static bool opt_run_on_inhomogenous_hosts = false;
 static bool opt_allow_different_solver_binaries = true;
 // whether we only simulate the experiments associated with the grid queue
 static bool simulate = false;
+// number of jobs that are claimed and prepared in advance for workers that are still busy
+static int opt_prefetch_jobs = 1;
+// time (s) after which prefetched jobs that weren't started are handed back to the DB
+static time_t opt_lease_time = 600;
+// number of threads that process the results of finished jobs
+static int opt_result_threads = 2;
+// how long (s) the list of experiments and their CPU counts is cached
+static time_t opt_experiment_cache_ttl = 5;
+// number of jobs of one solver binary that are claimed in a row, 0 disables grouping by solver binary
+static int opt_solver_group_budget = 0;
+// whether the client enforces the limits of the jobs itself instead of runsolver, see watcher.cc
+static bool opt_builtin_watcher = false;
+// parent cgroup (v2) of the cgroups of the jobs, empty if cgroups aren't used
+static string opt_cgroup;
+// how the PUs are selected and assigned to the jobs, see topology_select_pus() and reserve_cpus()
+static PlacementPolicy opt_placement = PLACEMENT_SPREAD;
+// whether performance counters are attached to the jobs, see perfcounters.cc
+static bool opt_perf_counters = false;
+// interval (ms) of the resource sampler, 0 if the jobs aren't sampled, see sampler.cc
+static int opt_sample_interval = 0;
+
+// cached experiment selection state by grid queue, see choose_experiment()
+static pthread_mutex_t experiment_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static map<int, time_t> experiment_cache_time;
+static map<int, vector<Experiment> > cached_experiments;
+static map<int, int> cached_cpu_count_by_experiment;
+
+// the grid queues the client takes jobs from and their weights. The client signs on to the
+// first grid queue, its number of CPUs determines the worker slots.
+static vector<int> grid_queue_ids;
+static map<int, int> grid_queue_weights;
+// number of CPUs of the jobs of each grid queue whose solver config doesn't specify it
+static map<int, int> cpus_per_job_by_grid_queue;
+// number of CPUs used by the running jobs of each grid queue, see order_grid_queues()
+static pthread_mutex_t grid_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static map<int, int> running_cpus_by_grid_queue;
+
+// number of CPUs of the grid queue and how many of them aren't used by running jobs
+static int grid_queue_cpus = 0;
+static int free_cpus = 0;
+// number of CPUs of jobs whose solver config doesn't specify it
+static int default_cpus_per_job = 1;
+// whether solver configs can specify the number of CPUs of their jobs (SolverConfig.numCPUs)
+static bool solver_config_cpus = false;
+// PUs of the grid queue in topological order, jobs are pinned to ranges of this list
+static vector<int> pu_order;
+static vector<bool> pu_used;
+// NUMA node of each PU of pu_order, empty if the host has only one node
+static map<int, int> pu_nodes;
+// L3 cache of each PU of pu_order (-1 if unknown)
+static map<int, int> pu_l3_caches;
+// maximum number of running jobs that may share an L3 cache while a job of the grid queue is started,
+// key 0 applies to all grid queues without an entry. Read from l3_job_limit in the config.
+static map<int, int> l3_job_limit_by_grid_queue;
+
+// instances and solver binaries on the local disk, jobs using them are claimed first.
+// Filled before the prefetch thread is started and only used by the prefetch thread after that.
+static LocalResources local_resources;
 
 // upper limit for check for jobs interval increase in ms if the client didn't get a job despite idle workers
 const unsigned int CHECK_JOBS_INTERVAL_UPPER_LIMIT = 10000;
+// no further jobs are started while less memory (MB) than this is available on the system
+const int MIN_AVAILABLE_MEMORY = 256;
+// how often (ms) the available memory is checked while jobs are held back because of it
+const int MEMORY_CHECK_INTERVAL = 1000;
+// time (s) at the end of the walltime that is reserved for processing results and signing off
+const int WALLTIME_MARGIN = 60;
+// how often (ms) the CPU time and memory usage of the jobs are checked by the built-in watcher
+const int WATCHER_CHECK_INTERVAL = 100;
+// time (s) between SIGTERM and SIGKILL when a job exceeded a limit of the built-in watcher
+const int WATCHER_KILL_DELAY = 2;
 
 // declared in database.cc
 extern Jobserver* jobserver;
@@ -123,13 +219,29 @@ char** environp;
 #define COMPILATION_TIME "Compiled at "__DATE__" "__TIME__
 
 string tempfiles_base_path = "/tmp/solver_tempfiles";
+// size (MB) of the tmpfs mounted on the temporary directory of each job, 0 for plain directories
+static int tempfiles_size_limit = 0;
 
 template <typename T>
 T max_(const T& a, const T& b) { return a > b ? a : b; }
+
 template <typename T>
 T min_(const T& a, const T& b) { return a < b ? a : b; }
 
+/**
+ * Returns the number of seconds a job may run so that it finishes within the walltime.
+ *
+ * @return the remaining time (s), 0 if no more jobs should be started, -1 if there's no walltime
+ */
+static int remaining_runtime() {
+    if (walltime_deadline == 0) {
+        return -1;
+    }
+    return max_((int)(walltime_deadline - monotonic_time()), 0);
+}
+
 int main(int argc, char* argv[], char **envp) {
+    double t_client_started = monotonic_time();
     environp = envp;
     if (argc > 1 && string(argv[1]) == "--help") {
         print_usage();
@@ -151,6 +263,16 @@ int main(int argc, char* argv[], char **envp) {
         { "walltime", required_argument, 0, 't'},
         { "config", required_argument, 0, 'c' },
         { "tempfiles_base_path", required_argument, 0, 'f' },
+        { "prefetch_jobs", required_argument, 0, 'j' },
+        { "result_threads", required_argument, 0, 'r' },
+        { "lease_time", required_argument, 0, 'e' },
+        { "experiment_cache_ttl", required_argument, 0, 'u' },
+        { "solver_group_budget", required_argument, 0, 'g' },
+        { "builtin_watcher", no_argument, 0, 'n' },
+        { "cgroup", required_argument, 0, 'a' },
+        { "placement", required_argument, 0, 'm' },
+        { "perf_counters", no_argument, 0, 'x' },
+        { "sample_interval", required_argument, 0, 'o' },
         {0,0,0,0} };
 
 	opt_log_path = ".";
@@ -160,7 +282,7 @@ int main(int argc, char* argv[], char **envp) {
 	while (optind < argc) {
 		int index = -1;
 		struct option * opt = 0;
-		int result = getopt_long(argc, argv, "c:v:lw:i:kb:hsp:d:t:f:", long_options,
+		int result = getopt_long(argc, argv, "c:v:lw:i:kb:hsp:d:t:f:j:r:e:u:g:na:m:xo:", long_options,
 				&index);
 		if (result == -1)
 			break; /* end of list */
@@ -203,6 +325,40 @@ int main(int argc, char* argv[], char **envp) {
             break;
         case 'f':
             tempfiles_base_path = string(optarg);
+            break;
+        case 'j':
+            opt_prefetch_jobs = atoi(optarg);
+            break;
+        case 'r':
+            opt_result_threads = max_(atoi(optarg), 1);
+            break;
+        case 'e':
+            opt_lease_time = atoi(optarg);
+            break;
+        case 'u':
+            opt_experiment_cache_ttl = atoi(optarg);
+            break;
+        case 'g':
+            opt_solver_group_budget = max_(atoi(optarg), 0);
+            break;
+        case 'n':
+            opt_builtin_watcher = true;
+            break;
+        case 'a':
+            opt_cgroup = string(optarg);
+            break;
+        case 'm':
+            if (!topology_parse_policy(optarg, opt_placement)) {
+                cout << "unknown placement policy " << optarg << endl;
+                print_usage();
+                return 1;
+            }
+            break;
+        case 'x':
+            opt_perf_counters = true;
+            break;
+        case 'o':
+            opt_sample_interval = max_(atoi(optarg), 0);
             break;
 		case 0: /* all parameter that do not */
 			/* appear in the optstring */
@@ -218,6 +374,14 @@ int main(int argc, char* argv[], char **envp) {
 			return 1;
 		}
 	}
+    int walltime = parse_walltime(opt_walltime);
+    if (walltime == -1) {
+        return 1;
+    }
+    if (walltime > 0) {
+        // jobs have to finish WALLTIME_MARGIN seconds before the walltime ends
+        walltime_deadline = t_client_started + walltime - WALLTIME_MARGIN;
+    }
 	base_path = ".";
     if (opt_base_path != "") base_path = opt_base_path;
     if (opt_download_path != "") {
@@ -230,13 +394,18 @@ int main(int argc, char* argv[], char **envp) {
 
 	// read configuration
 	string hostname, username, password, database, jobserver_hostname;
-	int port = -1, grid_queue_id = -1, jobserver_port = 3307;
-	read_config(hostname, username, password, database, port, grid_queue_id, jobserver_hostname, jobserver_port, sandbox_command, opt_allow_different_solver_binaries);
+	int port = -1, jobserver_port = 3307;
+	vector<int> weights;
+	read_config(hostname, username, password, database, port, grid_queue_ids, weights, jobserver_hostname, jobserver_port, sandbox_command, opt_allow_different_solver_binaries);
     if (hostname == "" || username == "" || database == ""
-		|| port == -1 || grid_queue_id == -1) {
+		|| port == -1 || grid_queue_ids.empty()) {
 		log_error(AT, "Invalid configuration file!");
 		return 1;
 	}
+	int grid_queue_id = grid_queue_ids[0];
+	for (size_t i = 0; i < grid_queue_ids.size(); i++) {
+	    grid_queue_weights[grid_queue_ids[i]] = weights[i];
+	}
     database_name = database;
 
     // set up dirs
@@ -345,14 +514,21 @@ int main(int argc, char* argv[], char **envp) {
         methods.sign_on = sign_on;
         methods.sign_off = sign_off;
         methods.choose_experiment = choose_experiment;
-        methods.db_fetch_job = db_fetch_job;
+        methods.db_fetch_jobs = db_fetch_jobs;
         methods.db_update_job = db_update_job;
+        methods.db_update_start_time = db_update_start_time;
         methods.increment_core_count = increment_core_count;
     }
 	client_id = methods.sign_on(grid_queue_id);
 
     // set up signal handler
     set_signal_handler(&signal_handler);
+
+    // set up the event loop (wakes up the main loop on terminated jobs and messages)
+    if (!events_init()) {
+        log_error(AT, "Couldn't initialize event loop.");
+        exit_client(1);
+    }
 	
     if (!simulate)
         start_message_thread(client_id);
@@ -405,29 +581,41 @@ void kill_job(int job_id) {
         if (it->used && (job_id == -1 || it->current_job.idJob == job_id)) {
             log_message(LOG_IMPORTANT, "Killing job with id %d.", it->current_job.idJob);
             kill_process(it->pid, 3);
+            if (!it->cgroup.empty()) {
+                cgroup_kill(it->cgroup);
+            }
             int proc_stat;
-            waitpid(it->pid, &proc_stat, 0);
-            
-            string watcher_output_filename = get_watcher_output_filename(it->current_job);
-            
-            log_message(LOG_DEBUG, "Loading watcher output");
-            if (!load_file_string(watcher_output_filename, it->current_job.watcherOutput)) {
-                log_error(AT, "Could not read watcher output file.");
+            struct rusage usage;
+            wait4(it->pid, &proc_stat, 0, &usage);
+            if (!it->cgroup.empty()) {
+                janitor_remove_cgroup(it->cgroup);
             }
-            log_message(LOG_DEBUG, "Starting to process results");
-
-            stringstream ss(it->current_job.watcherOutput);
-            float cputime;
-            if (parse_watcher_line(ss, "CPU time (s):", cputime)) {
-                it->current_job.resultTime = cputime;
-                log_message(LOG_IMPORTANT, "[Job %d] CPUTime: %f", 
-                    it->current_job.idJob, it->current_job.resultTime);
+            
+            if (opt_builtin_watcher) {
+                watcher_set_results(it->current_job, proc_stat, usage, monotonic_time() - it->start_time, it->cpu_time, 0);
             }
-            ss.clear(); ss.seekg(0);
-            float realtime;
-            if (parse_watcher_line(ss, "Real time (s):", realtime)) {
-            	it->current_job.wallTime = realtime;
-            	log_message(LOG_IMPORTANT, "[Job %d] wall time: %f", it->current_job.idJob, it->current_job.wallTime);
+            else {
+                string watcher_output_filename = get_watcher_output_filename(it->current_job);
+            
+                log_message(LOG_DEBUG, "Loading watcher output");
+                if (!load_file_string(watcher_output_filename, it->current_job.watcherOutput)) {
+                    log_error(AT, "Could not read watcher output file.");
+                }
+                log_message(LOG_DEBUG, "Starting to process results");
+
+                stringstream ss(it->current_job.watcherOutput);
+                float cputime;
+                if (parse_watcher_line(ss, "CPU time (s):", cputime)) {
+                    it->current_job.resultTime = cputime;
+                    log_message(LOG_IMPORTANT, "[Job %d] CPUTime: %f", 
+                        it->current_job.idJob, it->current_job.resultTime);
+                }
+                ss.clear(); ss.seekg(0);
+                float realtime;
+                if (parse_watcher_line(ss, "Real time (s):", realtime)) {
+                	it->current_job.wallTime = realtime;
+                	log_message(LOG_IMPORTANT, "[Job %d] wall time: %f", it->current_job.idJob, it->current_job.wallTime);
+                }
             }
 
             // TODO: cost binary
@@ -436,9 +624,18 @@ void kill_job(int job_id) {
             it->current_job.status = 20;
             it->current_job.resultCode = 0;
             defer_signals();
+            if (opt_sample_interval > 0) {
+                sampler_remove_job(it->current_job);
+            }
             methods.db_update_job(it->current_job);
             decrement_core_count(client_id, it->current_job.idExperiment);
+            update_cached_cpu_count(it->current_job.idExperiment, -1);
             reset_signal_handler();
+            perf_counters_close(it->perf_counter_fds);
+            ostringstream tempfiles_path;
+            tempfiles_path << tempfiles_base_path << "/" << it->current_job.idJob;
+            janitor_remove(tempfiles_path.str());
+            release_cpus(*it);
             it->used = false;
             it->pid = 0;
             if (job_id != -1) {
@@ -498,115 +695,109 @@ void update_jobcpulimit(int job_id, int new_limit) {
 }
 */
 
-#ifdef use_hwloc
-static void allocate_pus(hwloc_topology_t topology, hwloc_obj_t obj, int depth, set<int> *pu_ids, int num_pus, unsigned int pus_per_set, unsigned int pus_to_allocate) {
-    if (pus_to_allocate == 0)
-        return;
-    if (hwloc_compare_types(obj->type, HWLOC_OBJ_PU) == 0) {
-        for (int i = 0; i < num_pus; i++) {
-            if (pu_ids[i].size() < pus_per_set) {
-                pu_ids[i].insert(obj->os_index);
-                break;
-            }
-        }
+/**
+ * Initializes the worker slots. Every job occupies at least one of the grid queue's
+ * CPUs, so there is one slot per CPU. The CPUs a job runs on are assigned when
+ * the job is started, see reserve_cpus(). With the core placement policy the number
+ * of CPUs is reduced to the number of physical cores.
+ *
+ * @param grid_queue the grid queue of the client
+ */
+void initialize_workers(GridQueue &grid_queue) {
+    grid_queue_cpus = max_(grid_queue.numCPUs, 1);
+
+    vector<ProcessingUnit> pus;
+    bool have_topology = topology_read(pus);
+    int num_cores = topology_count_cores(pus);
+    if (have_topology && opt_placement == PLACEMENT_CORE && num_cores < grid_queue_cpus) {
+        log_message(LOG_IMPORTANT, "WARNING: Using %d of the %d CPUs of the grid queue, the placement policy core leaves SMT siblings idle.",
+                    num_cores, grid_queue_cpus);
+        grid_queue_cpus = num_cores;
+    }
+    free_cpus = grid_queue_cpus;
+    default_cpus_per_job = max_(min(grid_queue.numCPUsPerJob, grid_queue_cpus), 1);
+
+    if (grid_queue_cpus % default_cpus_per_job != 0) {
+        log_message(LOG_IMPORTANT, "WARNING: Number of CPUs per job is not a multiple of number of CPUs for this grid queue.");
     }
-    unsigned int num_nodes = obj->arity;
-    if (num_nodes == 0) {
+    workers.resize(grid_queue_cpus, Worker());
+    log_message(LOG_IMPORTANT, "Initializing %d worker slots, jobs use %d CPU(s) unless their solver config specifies otherwise.",
+                workers.size(), default_cpus_per_job);
+
+    if (!have_topology) {
+        log_message(LOG_IMPORTANT, "WARNING: Could not determine hardware topology. Binding solvers to processing units is not possible.");
+        if (!l3_job_limit_by_grid_queue.empty()) {
+            log_message(LOG_IMPORTANT, "WARNING: L3 job limits are not enforced.");
+        }
         return;
     }
-    int num = pus_to_allocate / num_nodes;
-    for (unsigned int i = 0; i < num_nodes; i++) {
-        int t = num;
-        if (i == 0) {
-            t += pus_to_allocate % num_nodes;
+    set<int> packages;
+    set<int> l3_caches;
+    for (vector<ProcessingUnit>::iterator it = pus.begin(); it != pus.end(); ++it) {
+        packages.insert(it->package);
+        l3_caches.insert(it->l3_cache);
+    }
+    log_message(LOG_IMPORTANT, "Found %d socket(s).", (int)packages.size());
+    log_message(LOG_IMPORTANT, "Found %d L3 cache(s).", (int)l3_caches.size());
+    log_message(LOG_IMPORTANT, "Found %d core(s).", num_cores);
+    log_message(LOG_IMPORTANT, "Found %d processing unit(s).", (int)pus.size());
+    if ((int)pus.size() < grid_queue_cpus) {
+        log_message(LOG_IMPORTANT, "Number of processing units is less than number of cores specified for this grid queue. Binding solvers to processing units is not possible.");
+        if (!l3_job_limit_by_grid_queue.empty()) {
+            log_message(LOG_IMPORTANT, "WARNING: L3 job limits are not enforced.");
         }
-        allocate_pus(topology, obj->children[i], depth+1, pu_ids, num_pus, pus_per_set, t);
+        return;
     }
-}
-#endif
-
-void initialize_workers(GridQueue &grid_queue) {
-    int cpus_per_worker = grid_queue.numCPUsPerJob;
-
-    if (grid_queue.numCPUs % cpus_per_worker != 0) {
-        log_message(LOG_IMPORTANT, "WARNING: Number of CPUs per worker is not a multiple of number of CPUs for this grid queue.");
+    // the selected PUs are kept in topological order so that neighbouring entries share caches and sockets
+    topology_select_pus(pus, grid_queue_cpus, opt_placement, pu_order);
+    pu_used.resize(pu_order.size(), false);
+    stringstream s;
+    for (unsigned int i = 0; i < pu_order.size(); i++) {
+        if (i > 0) s << ',';
+        s << pu_order[i];
     }
-    workers.resize(grid_queue.numCPUs / cpus_per_worker, Worker());
-    log_message(LOG_IMPORTANT, "Initializing %d workers.", workers.size());
-
-#ifdef use_hwloc
-    log_message(LOG_IMPORTANT, "INFORMATION: Using hwloc to determine hardware topology.");
-
-    hwloc_topology_t topology;
-    hwloc_topology_init(&topology);
-    hwloc_topology_load(topology);
-
-    int num_pu = 0;
-    int num_cores = 0;
-    int num_sockets = 0;
-    int depth = hwloc_get_type_depth(topology, HWLOC_OBJ_PU);
-    if (depth == HWLOC_TYPE_DEPTH_UNKNOWN) {
-        num_pu = -1;
-    } else {
-        num_pu = hwloc_get_nbobjs_by_type(topology, HWLOC_OBJ_PU);
+    log_message(LOG_IMPORTANT, "Binding solvers to PU(s)#%s (placement policy %s)", s.str().c_str(),
+                topology_policy_name(opt_placement));
+    for (vector<ProcessingUnit>::iterator it = pus.begin(); it != pus.end(); ++it) {
+        if (find(pu_order.begin(), pu_order.end(), it->id) != pu_order.end()) {
+            pu_l3_caches[it->id] = it->l3_cache;
+        }
     }
-
-    depth = hwloc_get_type_depth(topology, HWLOC_OBJ_CORE);
-    if (depth == HWLOC_TYPE_DEPTH_UNKNOWN) {
-        num_cores = -1;
-    } else {
-        num_cores = hwloc_get_nbobjs_by_type(topology, HWLOC_OBJ_CORE);
+    for (map<int, int>::iterator it = l3_job_limit_by_grid_queue.begin(); it != l3_job_limit_by_grid_queue.end(); ++it) {
+        if (it->first == 0) {
+            log_message(LOG_IMPORTANT, "At most %d job(s) share an L3 cache.", it->second);
+        } else {
+            log_message(LOG_IMPORTANT, "Jobs of grid queue %d are started on L3 caches with less than %d running job(s).",
+                        it->first, it->second);
+        }
     }
 
-    depth = hwloc_get_type_depth(topology, HWLOC_OBJ_SOCKET);
-    if (depth == HWLOC_TYPE_DEPTH_UNKNOWN) {
-        num_sockets = -1;
-    } else {
-        num_sockets = hwloc_get_nbobjs_by_type(topology, HWLOC_OBJ_SOCKET);
+    // the memory of the jobs is bound to the NUMA nodes of their PUs
+    set<int> nodes;
+    for (vector<ProcessingUnit>::iterator it = pus.begin(); it != pus.end(); ++it) {
+        nodes.insert(it->node);
     }
-
-    if (num_pu == -1 || num_cores == -1 || num_sockets == -1) {
-        log_message(LOG_IMPORTANT, "WARNING: Could not determine hardware topology. Binding solvers to processing units is not possible.");
-    } else {
-        log_message(LOG_IMPORTANT, "Found %d socket(s).", num_sockets);
-        log_message(LOG_IMPORTANT, "Found %d core(s).", num_cores);
-        log_message(LOG_IMPORTANT, "Found %d processing unit(s).", num_pu);
-        set<int> cpu_ids[num_pu];
-        if (num_pu < grid_queue.numCPUs) {
-            log_message(LOG_IMPORTANT, "Number of processing units is less than number of cores specified for this grid queue. Binding solvers to processing units is not possible.");
-        } else {
-            allocate_pus(topology, hwloc_get_root_obj(topology), 0, cpu_ids, num_pu, cpus_per_worker, grid_queue.numCPUs);
-            int current = 0;
-            // initialize core ids
-            for (vector<Worker>::iterator it = workers.begin(); it != workers.end(); ++it) {
-                stringstream s;
-                for (set<int>::iterator it2 = cpu_ids[current].begin(); it2 != cpu_ids[current].end(); it2++) {
-                    s << *it2;
-                    (*it).core_ids.insert(*it2);
-                    if (++it2 != cpu_ids[current].end()) {
-                        s << ',';
-                    }
-                    it2--;
-                }
-                log_message(LOG_IMPORTANT, "Worker %d: PU(s)#%s", current, s.str().c_str());
-                current++;
+    if (nodes.size() > 1 && nodes.count(-1) == 0) {
+        for (vector<ProcessingUnit>::iterator it = pus.begin(); it != pus.end(); ++it) {
+            if (find(pu_order.begin(), pu_order.end(), it->id) != pu_order.end()) {
+                pu_nodes[it->id] = it->node;
             }
         }
+        log_message(LOG_IMPORTANT, "Found %d NUMA node(s), binding the memory of the solvers to the nodes of their PUs.", (int)nodes.size());
     }
-#else
-    log_message(LOG_IMPORTANT, "INFORMATION: Not using hwloc. Cores will be allocated by operating system.");
-#endif
 }
 
 /**
  * This function contains the main processing loop.
  * After fetching the grid queue information from the database
  * numCPUs worker slots are initialized. In a loop then following happens:
- * 1. If there are any unused worker slots, try to find a job for each of them.
- * 2. If the client didn't start processing any jobs since opt_wait_jobs_time
+ * 1. Handle workers (look for terminated jobs and process their results)
+ * 2. Check for messages in the database that the client should process.
+ * 3. If there are any unused worker slots, start a job that was prepared by the prefetch
+ *    thread for each of them and tell the prefetch thread how many workers are still idle.
+ * 4. If the client didn't start processing any jobs since opt_wait_jobs_time
  *    seconds and there aren't any jobs running, it exits.
- * 3. Handle workers (look for terminated jobs and process their results)
- * 4. Check for messages in the database that the client should process.
+ * 5. Block until a job terminates, the prefetch thread prepared a job or a message arrives.
  * 
  * @param grid_queue_id The id (DB primary key) of the grid the client is running on.
  */
@@ -633,11 +824,60 @@ void process_jobs(int grid_queue_id) {
     
     // initialize worker slots
     initialize_workers(grid_queue);
+    cpus_per_job_by_grid_queue[grid_queue_id] = default_cpus_per_job;
+    for (vector<int>::iterator q = grid_queue_ids.begin() + 1; q != grid_queue_ids.end(); ++q) {
+        GridQueue other_grid_queue;
+        if (get_grid_queue_info(*q, other_grid_queue) != 1) {
+            log_error(AT, "Couldn't retrieve information of grid queue %d", *q);
+            exit_client(1);
+        }
+        cpus_per_job_by_grid_queue[*q] = max_(min(other_grid_queue.numCPUsPerJob, grid_queue_cpus), 1);
+        log_message(LOG_INFO, "Also taking jobs from grid queue %s with weight %d, %d CPU(s) per job.",
+                    other_grid_queue.name.c_str(), grid_queue_weights[*q], cpus_per_job_by_grid_queue[*q]);
+    }
+
+    if (opt_cgroup != "") {
+        if (!cgroup_init(opt_cgroup)) {
+            exit_client(1);
+        }
+    }
 
     log_message(LOG_DEBUG, "Initialized %d worker slots. Starting main processing loop.\n\n", workers.size());
     
-    unsigned int check_jobs_interval = opt_check_jobs_interval;
+    if (!simulate) {
+        get_local_resources(local_resources);
+    }
+    solver_config_cpus = has_solver_config_cpus() == 1;
+    if (solver_config_cpus) {
+        log_message(LOG_INFO, "Solver configurations specify the number of CPUs of their jobs.");
+    }
+    if (opt_perf_counters && has_result_counters() == 1) {
+        log_message(LOG_INFO, "Storing the performance counters of the jobs in ExperimentResults.");
+    }
+    if (has_claim_index() == 0) {
+        log_message(LOG_IMPORTANT, "WARNING: ExperimentResults doesn't have the index of contrib/indexes.sql, "
+                                   "claiming jobs reads all jobs of an experiment.");
+    }
+    if (has_claim_procedure() == 1) {
+        log_message(LOG_INFO, "Claiming jobs with the claimJobs procedure.");
+    }
+    // in simulation mode the jobs aren't claimed in the DB, so there are no leases
+    start_prefetch_thread(grid_queue_id, grid_queue_cpus / default_cpus_per_job, opt_prefetch_jobs, opt_allow_different_solver_binaries,
+                          opt_check_jobs_interval, max_(CHECK_JOBS_INTERVAL_UPPER_LIMIT, opt_check_jobs_interval),
+                          simulate ? 0 : opt_lease_time, opt_solver_group_budget);
+    start_result_threads(opt_result_threads);
+    start_janitor_thread();
+    if (opt_sample_interval > 0) {
+        start_sampler_thread(opt_sample_interval);
+    }
+
+    int last_num_active_workers = 0;
+    bool was_draining = false;
     while (true) {
+        handle_workers(workers);
+        int watcher_timeout = opt_builtin_watcher ? check_job_limits() : -1;
+        process_messages();
+
         int solver_binary_id = -1;
         if (!opt_allow_different_solver_binaries) {
             // get the solver binary id of currently running jobs
@@ -648,27 +888,79 @@ void process_jobs(int grid_queue_id) {
                 }
             }
         }
+        // jobs that can't finish within the walltime are handed back
+        int max_runtime = remaining_runtime();
+        // the prefetch mutex must not be held when exit_client() is called by the signal handler
+        defer_signals();
+        prefetch_update_jobs(max_runtime);
+        reset_signal_handler();
+        bool draining = max_runtime == 0;
+        if (draining && !was_draining) {
+            log_message(LOG_IMPORTANT, "Walltime is used up. Not starting any further jobs.");
+        }
+        was_draining = draining;
+
+        bool no_prepared_jobs = false;
+        bool resources_full = false;
         for (vector<Worker>::iterator it = workers.begin(); it != workers.end(); ++it) {
+            if (free_cpus == 0 || no_prepared_jobs || resources_full || draining) {
+                break;
+            }
             if (it->used == false) {
-                if (!start_job(grid_queue_id, solver_binary_id, *it)) {
-                    // if there's a free worker slot but a job couldn't be started
-                    // we increase the check for jobs interval to reduce the load on the database
-                    // especially when there are no more jobs left, double each time, cap at the hard-coded
-                    // limit or the limit that was given as option
-                    check_jobs_interval *= 2;
-                    check_jobs_interval = min_(check_jobs_interval, max_(CHECK_JOBS_INTERVAL_UPPER_LIMIT, opt_check_jobs_interval));
-                    break;
+                int res = start_job(*it, get_admissible_memory(), free_cpus);
+                if (res == 0) {
+                    // no prepared jobs left, the prefetch thread wakes us up when there are new ones
+                    no_prepared_jobs = true;
                 }
-                else {
-                    check_jobs_interval = opt_check_jobs_interval;
+                else if (res == -1) {
+                    // the prepared jobs need more CPUs or memory than available, leave the remaining
+                    // CPUs idle until running jobs finish or memory is released
+                    resources_full = true;
+                }
+                else if (!opt_allow_different_solver_binaries) {
                     solver_binary_id = it->current_job.idSolverBinary;
                 }
             }
         }
-        
+        int admissible_memory = get_admissible_memory();
+        if (resources_full && free_cpus > 0 && admissible_memory >= 0 && !draining) {
+            // prepared jobs that need more memory than available would keep the CPUs idle until running
+            // jobs finish, hand them back and claim jobs that fit instead. Jobs that need more CPUs are kept.
+            defer_signals();
+            int num_released = prefetch_release_jobs(admissible_memory);
+            reset_signal_handler();
+            if (num_released > 0) {
+                log_message(LOG_INFO, "Handed back %d prepared job(s) that need more than the available %d MB of memory.",
+                            num_released, admissible_memory);
+                no_prepared_jobs = true;
+            }
+        }
+        // idle capacity in jobs of the default width
+        int num_idle_workers = 0;
+        if (no_prepared_jobs && !draining) {
+            num_idle_workers = max_(free_cpus / default_cpus_per_job, 1);
+        }
+        // while jobs are running, only jobs that fit into the remaining memory are claimed. Under memory
+        // pressure the claimed jobs wait until memory is released.
+        int max_memory = admissible_memory >= 0 && admissible_memory < INT_MAX ? admissible_memory : -1;
+        defer_signals();
+        prefetch_request(num_idle_workers, solver_binary_id, max_memory);
+        reset_signal_handler();
+
         bool any_running_jobs = false;
+        int num_active_workers = 0;
         for (vector<Worker>::iterator it = workers.begin(); it != workers.end(); ++it) {
             any_running_jobs |= it->used;
+            if (it->used) num_active_workers++;
+        }
+        if (resources_full && num_active_workers != last_num_active_workers) {
+            log_message(LOG_INFO, "Prepared jobs don't fit, running %d job(s) on %d of %d CPUs.",
+                        num_active_workers, grid_queue_cpus - free_cpus, grid_queue_cpus);
+        }
+        last_num_active_workers = num_active_workers;
+        if (draining && !any_running_jobs) {
+            log_message(LOG_IMPORTANT, "All running jobs finished before the end of the walltime. Exiting.");
+            exit_client(0, true);
         }
         if (!any_running_jobs && time(NULL) - t_started_last_job > opt_wait_jobs_time) {
             // got no jobs since opt_wait_jobs_time seconds and there aren't any jobs running.
@@ -678,41 +970,144 @@ void process_jobs(int grid_queue_id) {
             handle_workers(workers);
             exit_client(0, true);
         }
-        
-        int num_finished = handle_workers(workers);
-        
-        process_messages();
-        if (num_finished == 0) {
-            usleep(check_jobs_interval * 1000);
+
+        // wait for a job to terminate, a prepared job or a message. If nothing is running, wake
+        // up in time to check whether the client should exit.
+        int timeout = -1;
+        if (!any_running_jobs) {
+            timeout = (int)(t_started_last_job + opt_wait_jobs_time + 1 - time(NULL)) * 1000;
+            timeout = max_(timeout, 0);
+        }
+        if (resources_full && (timeout == -1 || timeout > MEMORY_CHECK_INTERVAL)) {
+            timeout = MEMORY_CHECK_INTERVAL;
         }
+        if (watcher_timeout != -1 && (timeout == -1 || timeout > watcher_timeout)) {
+            timeout = watcher_timeout;
+        }
+        events_wait(timeout);
     }
 }
 
-bool choose_experiment(int grid_queue_id, Experiment &chosen_exp) {
-    // get list of possible experiments (those with the same grid queue
-    // the client was started with)
+/**
+ * Returns the list of possible experiments (those with the same grid queue the client was
+ * started with) and the number of CPUs working on each experiment.
+ * Both are cached for <code>opt_experiment_cache_ttl</code> seconds, the CPU counts of this
+ * client's jobs are kept up to date by <code>update_cached_cpu_count()</code> meanwhile.
+ *
+ * @param grid_queue_id the id of the grid queue
+ * @param experiments vector the experiments are put in
+ * @param cpu_count_by_experiment map the CPU counts are put in
+ */
+static void get_experiment_state(int grid_queue_id, vector<Experiment>& experiments, map<int, int>& cpu_count_by_experiment) {
+    pthread_mutex_lock(&experiment_cache_mutex);
+    if (experiment_cache_time.count(grid_queue_id)
+            && time(NULL) - experiment_cache_time[grid_queue_id] < opt_experiment_cache_ttl) {
+        experiments = cached_experiments[grid_queue_id];
+        cpu_count_by_experiment = cached_cpu_count_by_experiment;
+        pthread_mutex_unlock(&experiment_cache_mutex);
+        return;
+    }
+    pthread_mutex_unlock(&experiment_cache_mutex);
+
     log_message(LOG_DEBUG, "Fetching list of experiments:");
-    vector<Experiment> experiments;
-    
-    defer_signals();
     get_possible_experiments(grid_queue_id, experiments);
-    reset_signal_handler();
-    
-    if (experiments.empty()) {
-        log_message(LOG_DEBUG, "No experiments available");
-        return false;
-    }
-    
     for (vector<Experiment>::iterator it = experiments.begin(); it != experiments.end(); ++it) {
         log_message(LOG_DEBUG, "%d %s %d", it->idExperiment, it->name.c_str(), it->priority);
     }
-    
     log_message(LOG_DEBUG, "Fetching number of CPUs working on each experiment");
+    get_experiment_cpu_count(cpu_count_by_experiment);
+
+    pthread_mutex_lock(&experiment_cache_mutex);
+    experiment_cache_time[grid_queue_id] = time(NULL);
+    cached_experiments[grid_queue_id] = experiments;
+    cached_cpu_count_by_experiment = cpu_count_by_experiment;
+    pthread_mutex_unlock(&experiment_cache_mutex);
+}
+
+/**
+ * Applies a change of the number of CPUs this client uses for an experiment
+ * to the cached experiment selection state. May be called from any thread.
+ *
+ * @param experiment_id the id of the experiment
+ * @param delta the change of the CPU count
+ */
+void update_cached_cpu_count(int experiment_id, int delta) {
+    pthread_mutex_lock(&experiment_cache_mutex);
+    cached_cpu_count_by_experiment[experiment_id] += delta;
+    pthread_mutex_unlock(&experiment_cache_mutex);
+}
+
+/**
+ * Invalidates the cached experiment selection state, e.g. because the chosen
+ * experiment didn't have any jobs left.
+ */
+static void invalidate_experiment_cache() {
+    pthread_mutex_lock(&experiment_cache_mutex);
+    experiment_cache_time.clear();
+    pthread_mutex_unlock(&experiment_cache_mutex);
+}
+
+/**
+ * Copies the output limits and the cost settings of the experiment to the job.
+ */
+static void set_experiment_details(Job& job, const Experiment& exp) {
+    job.solver_output_preserve_first = exp.solver_output_preserve_first;
+    job.solver_output_preserve_last = exp.solver_output_preserve_last;
+    job.watcher_output_preserve_first = exp.watcher_output_preserve_first;
+    job.watcher_output_preserve_last = exp.watcher_output_preserve_last;
+    job.verifier_output_preserve_first = exp.verifier_output_preserve_first;
+    job.verifier_output_preserve_last = exp.verifier_output_preserve_last;
+    job.limit_solver_output = exp.limit_solver_output;
+    job.limit_watcher_output = exp.limit_watcher_output;
+    job.limit_verifier_output = exp.limit_verifier_output;
+    job.Cost_idCost = exp.Cost_idCost;
+}
+
+/**
+ * Orders the grid queues the client takes jobs from. The grid queue whose share of the CPUs
+ * used by this client's running jobs is furthest below its share of the weights comes first:
+ * argmax { weight(q) / sum_weights - CPUs(q) / sum_cpus }
+ * Grid queues with the same difference keep the order of the configuration file.
+ *
+ * @param queue_order vector the grid queue ids are put in
+ */
+static void order_grid_queues(vector<int>& queue_order) {
+    if (grid_queue_ids.size() == 1) {
+        queue_order = grid_queue_ids;
+        return;
+    }
+    pthread_mutex_lock(&grid_queue_mutex);
+    int weight_sum = 0, cpu_sum = 0;
+    for (vector<int>::iterator q = grid_queue_ids.begin(); q != grid_queue_ids.end(); ++q) {
+        weight_sum += grid_queue_weights[*q];
+        cpu_sum += running_cpus_by_grid_queue[*q];
+    }
+    vector<pair<float, int> > order;
+    for (size_t i = 0; i < grid_queue_ids.size(); i++) {
+        int q = grid_queue_ids[i];
+        float diff = weight_sum == 0 ? 0.0f : grid_queue_weights[q] / (float)weight_sum;
+        if (cpu_sum > 0) {
+            diff -= running_cpus_by_grid_queue[q] / (float)cpu_sum;
+        }
+        order.push_back(make_pair(-diff, (int)i));
+    }
+    pthread_mutex_unlock(&grid_queue_mutex);
+    sort(order.begin(), order.end());
+    queue_order.clear();
+    for (vector<pair<float, int> >::iterator it = order.begin(); it != order.end(); ++it) {
+        queue_order.push_back(grid_queue_ids[it->second]);
+    }
+}
+
+bool choose_experiment(int grid_queue_id, Experiment &chosen_exp) {
+    vector<Experiment> experiments;
     map<int, int> cpu_count_by_experiment;
+    get_experiment_state(grid_queue_id, experiments, cpu_count_by_experiment);
     
-    defer_signals();
-    get_experiment_cpu_count(cpu_count_by_experiment);
-    reset_signal_handler();
+    if (experiments.empty()) {
+        log_message(LOG_DEBUG, "No experiments available");
+        return false;
+    }
     
     int sum_cpus = 0;
     int priority_sum = 0;
@@ -758,7 +1153,7 @@ bool choose_experiment(int grid_queue_id, Experiment &chosen_exp) {
 }
 
 /**
- * Try to find a job for the passed worker slot.
+ * Try to claim jobs for the grid queue. This is called by the prefetch thread.
  * The following steps are performed:
  *
  * 1. Try to find an active experiment that has unprocessed jobs and try choose an experiment
@@ -771,331 +1166,694 @@ bool choose_experiment(int grid_queue_id, Experiment &chosen_exp) {
  *    - sum_priorities = 0: choose the experiment with the least amount of CPUs
  *    - sum_cpus = 0: choose the experiment with the highest priority
  *
- * 2. Try to fetch a job of the chosen experiment from the database. This can fail
- *    for multiple reasons, one of them being race conditions with our way of selecting
- *    a random row.
+ * 2. Try to fetch up to <code>num_jobs</code> jobs of the chosen experiment from the database
+ *    in one transaction. This can fail for multiple reasons, one of them being race conditions
+ *    with our way of selecting random rows.
  *
- * 3. If a job was selected, the computational ressources (instance, solver, parameters) have to
- *    be retrieved from the database.
+ * If the client takes jobs from several grid queues, the grid queues are tried in the order
+ * of order_grid_queues() until jobs were claimed, so that CPUs that the jobs of one grid queue
+ * leave idle are used by the jobs of the other grid queues.
  *
- * 4. runsolver is started from a fork of the client process. The worker slot is
- *    set to used and the details of the started job are stored in the worker aswell.
- *
- * @param grid_queue_id the id of the grid the client is running on.
- * @param worker the worker slot which should manage the job run.
- * @return true on success, false if there are no jobs or the job query failed
+ * @param solver_binary_id the solver binary the jobs should use, -1 for any
+ * @param num_jobs the maximum number of jobs to claim
+ * @param max_memory the maximum memory limit (MB) of the jobs, -1 for any
+ * @param jobs vector the claimed jobs are appended to
+ * @return the number of claimed jobs, 0 if there are no jobs or the job query failed
  *         (e.g. for transaction race condition reasons)
  */
-bool start_job(int grid_queue_id, int solver_binary_id, Worker& worker) {
-    log_message(LOG_DEBUG, "Trying to start processing a job");
-    Experiment chosen_exp;
-    if (!methods.choose_experiment(grid_queue_id, chosen_exp)) {
-        return false;
-    }
-    
-    Job job;
-    job.solver_output_preserve_first = chosen_exp.solver_output_preserve_first;
-    job.solver_output_preserve_last = chosen_exp.solver_output_preserve_last;
-    job.watcher_output_preserve_first = chosen_exp.watcher_output_preserve_first;
-    job.watcher_output_preserve_last = chosen_exp.watcher_output_preserve_last;
-    job.verifier_output_preserve_first = chosen_exp.verifier_output_preserve_first;
-    job.verifier_output_preserve_last = chosen_exp.verifier_output_preserve_last;
-    job.limit_solver_output = chosen_exp.limit_solver_output;
-    job.limit_watcher_output = chosen_exp.limit_watcher_output;
-    job.limit_verifier_output = chosen_exp.limit_verifier_output;
-    job.Cost_idCost = chosen_exp.Cost_idCost;
-
-    defer_signals();
-    int job_id = methods.db_fetch_job(client_id, grid_queue_id, chosen_exp.idExperiment, solver_binary_id, job);
-    // keep track of jobs that were set to running in the DB but are still downloading resources/parameters
-    // before a worker slot is actually assigned. This should prevent jobs from keeping the status running if
-    // the client is killed (by other means than messages) while downloading resources.
-    if (job_id != -1) downloading_job = job;
-
-    reset_signal_handler();
-    log_message(LOG_DEBUG, "Trying to fetch job, got %d", job_id);
-    
-    if (job_id != -1) {
-        Solver solver;
-        Instance instance;
-        string instance_binary;
-        string solver_base_path;
-        
-        ostringstream oss;
-        oss << "Host information:" << endl;
-        oss << setw(30) << "Number of cores: " << host_info.num_cores << endl;
-        oss << setw(30) << "Number of threads: " << host_info.num_threads << endl;
-        oss << setw(30) << "Hyperthreading: " << host_info.hyperthreading << endl;
-        oss << setw(30) << "Turboboost: " << host_info.turboboost << endl;
-        oss << setw(30) << "CPU model: " << host_info.cpu_model << endl;
-        oss << setw(30) << "Cache size (KB): " << host_info.cache_size << endl;
-        oss << setw(30) << "Total memory (MB): " << host_info.memory / 1024 / 1024 << endl;
-        oss << setw(30) << "Free memory (MB): " << host_info.free_memory / 1024 / 1024 << endl << endl;
-        job.launcherOutput = oss.str();
-
-        defer_signals();
-        methods.db_update_job(job);
-        reset_signal_handler();
-
-        log_message(LOG_DEBUG, "receiving solver informations");
-        if (!get_solver(job, solver)) {
-            log_error(AT, "Could not receive solver information.");
-            job.status = -5;
-            job.launcherOutput += get_log_tail();
-            defer_signals();
-            methods.db_update_job(job);
-            reset_signal_handler();
-            downloading_job.idJob = 0;
-            return false;
+int claim_jobs(int solver_binary_id, int num_jobs, int max_memory, vector<Job>& jobs) {
+    log_message(LOG_DEBUG, "Trying to claim %d jobs", num_jobs);
+    vector<int> queue_order;
+    order_grid_queues(queue_order);
+    for (vector<int>::iterator q = queue_order.begin(); q != queue_order.end(); ++q) {
+        Experiment chosen_exp;
+        if (!methods.choose_experiment(*q, chosen_exp)) {
+            continue;
         }
-        job.Solver_idSolver = solver.idSolver;
-        job.idSolverBinary = solver.idSolverBinary;
 
-        log_message(LOG_DEBUG, "receiving instance informations");
-        if (!get_instance(job, instance)) {
-        	log_error(AT, "Could not receive instance information.");
-        	job.status = -5;
-            job.launcherOutput += get_log_tail();
-            defer_signals();
-            methods.db_update_job(job);
-            reset_signal_handler();
-            downloading_job.idJob = 0;
-        	return false;
+        size_t first = jobs.size();
+        int num_claimed = methods.db_fetch_jobs(client_id, *q, chosen_exp.idExperiment, solver_binary_id, num_jobs,
+                                                remaining_runtime(), max_memory, local_resources, jobs);
+        log_message(LOG_DEBUG, "Trying to fetch %d jobs of grid queue %d, got %d", num_jobs, *q, num_claimed);
+        if (num_claimed == 0) {
+            // the experiment might be finished, don't choose it again because of stale data
+            invalidate_experiment_cache();
+            continue;
         }
-
-        log_message(LOG_DEBUG, "checking instance binary");
-        if (!get_instance_binary(instance, instance_binary)) {
-        	log_error(AT, "Could not receive instance binary.");
-        	job.status = -5;
-            job.launcherOutput += get_log_tail();
-            defer_signals();
-            methods.db_update_job(job);
-            reset_signal_handler();
-            downloading_job.idJob = 0;
-        	return false;
-        }
-        log_message(LOG_DEBUG, "checking solver binary");
-        if (!get_solver_binary(solver, solver_base_path)) {
-        	log_error(AT, "Could not receive solver binary.");
-        	job.status = -5;
-            job.launcherOutput += get_log_tail();
-            defer_signals();
-            methods.db_update_job(job);
-            reset_signal_handler();
-            downloading_job.idJob = 0;
-        	return false;
+        for (size_t i = first; i < jobs.size(); i++) {
+            set_experiment_details(jobs[i], chosen_exp);
+            jobs[i].computeQueue = *q;
         }
+        return num_claimed;
+    }
+    return 0;
+}
 
-        log_message(LOG_IMPORTANT, "Solver binary at %s", solver_base_path.c_str());
-        log_message(LOG_IMPORTANT, "Instance binary at %s", instance_binary.c_str());
-        
-        vector<Parameter> solver_parameters;
-        defer_signals();
-        if (get_solver_config_params(job.idSolverConfig, solver_parameters) != 1) {
-            log_error(AT, "Could not receive solver config parameters");
-            job.status = -5;
-            job.launcherOutput = get_log_tail();
-            methods.db_update_job(job);
-            reset_signal_handler();
-            downloading_job.idJob = 0;
-            return false;
-        }
-        reset_signal_handler();
-        string launch_command = "";
-#ifdef use_hwloc
-        if (!worker.core_ids.empty()) {
-            ostringstream oss;
-            oss << "taskset -c ";
-            for (set<int>::iterator it = worker.core_ids.begin(); it != worker.core_ids.end(); it++) {
-                oss << *it;
-                if (++it != worker.core_ids.end()) {
-                    oss << ',';
-                }
-                it--;
-            }
-            oss << " ";
-            launch_command += oss.str();
-        }
-#endif
-        launch_command += build_watcher_command(job);
-        launch_command += " -- ";
-        if (sandbox_command != "") {
-			launch_command += sandbox_command;
-			launch_command += " ";
-        }
-        ostringstream tempfiles_path;
-        tempfiles_path << tempfiles_base_path << "/" << job.idJob << "/";
-        if (!create_directory(tempfiles_path.str())) {
-        	log_error(AT, "Could not create temporary files directory for solver");
-        }
-        launch_command += build_solver_command(job, solver, solver_base_path, instance_binary, tempfiles_path.str(), solver_parameters);
-        log_message(LOG_IMPORTANT, "Launching job with: %s", launch_command.c_str());
-		
-        // write some details about the job to the launcher output column
-		
-        oss << endl << endl;
-		oss << "Job details:" << endl;
-		oss << setw(30) << "idJob: " << job.idJob << endl;
-		oss << setw(30) << "Solver: " << solver.solver_name << endl;
-		oss << setw(30) << "Binary: " << solver.binaryName << endl;
-		oss << setw(30) << "Launch command: " << launch_command << endl;
-		oss << setw(30) << "Seed: " << job.seed << endl;
-		oss << setw(30) << "Instance: " << instance.name << endl;
-		job.launcherOutput = oss.str();
-		
-        int pid = fork();
-        if (pid == 0) { // this is the child
-            setpgrp();
-            log_init_childprocess();
-            defer_signals();
-            char* command = new char[launch_command.length() + 1];
-            strcpy(command, launch_command.c_str());
-            char* exec_argv[4] = {strdup("/bin/bash") , strdup("-c"), command, NULL};
-
-            // on errors: the child process sends the SIGKILL signal to itself.
-            // This will cause the father process to set status of the job as watcher crash.
-            if (chdir(absolute_path(solver_base_path).c_str()))
-            {
-                log_error(AT, "Couldn't cd into solver base path %s", absolute_path(solver_base_path).c_str());
-                kill(getpid(), SIGKILL);
-            }
-            if (execve("/bin/bash", exec_argv, environp) == -1) {
-                log_error(AT, "Error in execve()");
-                kill(getpid(), SIGKILL);
+/**
+ * Blocks until the job server has a job for the grid queue or <code>timeout</code>
+ * milliseconds passed and claims it. This is called by the prefetch thread if there
+ * are no jobs instead of polling.
+ *
+ * @param grid_queue_id the id of the grid the client is running on.
+ * @param solver_binary_id the solver binary the job should use, -1 for any
+ * @param timeout maximum time (ms) to wait
+ * @param max_memory the maximum memory limit (MB) of the job, -1 for any
+ * @param jobs vector the claimed job is appended to
+ * @return the number of claimed jobs, -1 if waiting for jobs isn't possible (no job server)
+ */
+int wait_for_jobs(int grid_queue_id, int solver_binary_id, int timeout, int max_memory, vector<Job>& jobs) {
+    if (simulate) {
+        return -1;
+    }
+    size_t first = jobs.size();
+    int num_claimed = db_wait_for_jobs(client_id, grid_queue_id, solver_binary_id, timeout, remaining_runtime(),
+                                       max_memory, jobs);
+    if (num_claimed <= 0) {
+        return num_claimed;
+    }
+    for (size_t i = first; i < jobs.size(); i++) {
+        jobs[i].computeQueue = grid_queue_id;
+    }
+    // the job might belong to an experiment that isn't cached yet
+    invalidate_experiment_cache();
+    vector<Experiment> experiments;
+    map<int, int> cpu_count_by_experiment;
+    get_experiment_state(grid_queue_id, experiments, cpu_count_by_experiment);
+    for (size_t i = first; i < jobs.size(); i++) {
+        for (vector<Experiment>::iterator it = experiments.begin(); it != experiments.end(); ++it) {
+            if (it->idExperiment == jobs[i].idExperiment) {
+                set_experiment_details(jobs[i], *it);
+                break;
             }
-            kill(getpid(), SIGKILL); // should not be reached if execve doesn't fail
-        }
-        else if (pid > 0) {
-            // fork was successful, this is the parent
-            defer_signals();
-            t_started_last_job = time(NULL);
-			worker.used = true;
-			worker.current_job = job; // this is a copy of the job, not a reference or pointer
-			worker.current_job.instance_file_name = instance_binary;
-            worker.pid = pid;
-            downloading_job.idJob = 0; // 0 means there's no job for which the client is downloading resources at the moment
-            methods.increment_core_count(client_id, chosen_exp.idExperiment);
-            reset_signal_handler();
-            return true;
-        }
-        else {
-            log_error(AT, "Couldn't fork");
-            exit_client(1);
         }
     }
-    
-    return false;
+    return num_claimed;
 }
 
 /**
- * Build a filename for the watcher output file.
- * @param job the job which to build the watcher output filename for.
- * @return a filename
+ * Hands back the jobs of the experiments of the client's grid queues that were leased by
+ * clients which stopped reporting, see db_reclaim_leases(). This is called by the prefetch thread.
+ *
+ * @param lease_time time (s) after the last report of a client when its leases expire
+ * @return number of jobs that were handed back, -1 on errors
  */
-string get_watcher_output_filename(const Job& job) {
-    ostringstream oss;
-    oss << result_path << "/" << database_name << "_" << job.idJob << ".w";
-    return oss.str();
+int reclaim_leases(int lease_time) {
+    set<int> experiment_ids;
+    for (vector<int>::iterator q = grid_queue_ids.begin(); q != grid_queue_ids.end(); ++q) {
+        vector<Experiment> experiments;
+        map<int, int> cpu_count_by_experiment;
+        get_experiment_state(*q, experiments, cpu_count_by_experiment);
+        for (vector<Experiment>::iterator it = experiments.begin(); it != experiments.end(); ++it) {
+            experiment_ids.insert(it->idExperiment);
+        }
+    }
+    return db_reclaim_leases(experiment_ids, lease_time);
 }
 
 /**
- * Build a filename for the solver output file.
- * @param job the job which to build the solver output filename for.
- * @return a filename
+ * Writes a job whose resources are being downloaded to the database, unless the client is
+ * exiting. The job is reset by exit_client() then.
  */
-string get_solver_output_filename(const Job& job) {
-    ostringstream oss;
-    oss << result_path << "/" << database_name << "_" << job.idJob << ".o";
-    return oss.str();
+static void update_preparing_job(const Job& job) {
+    if (prefetch_begin_update()) {
+        methods.db_update_job(job);
+        prefetch_end_update();
+    }
 }
 
 /**
- * Builds the watcher command up to the point where the solver binary and
- * parameters should follow. The computational limits such as time and memory
- * limits are taken from the job. If the value of such a limit is -1, then no
- * limit is imposed.
- * 
- * e.g. "./runsolver --timestamp -w abc.w -o abc.o -C 1000"
- * Notice there's no trailing whitespace!
- * 
- * @param job The job that the watcher should launch
- * @return a command line string
+ * Retrieves the computational ressources (instance, solver, parameters) of a claimed job
+ * from the database. This is called by the prefetch thread.
+ * If this fails, the job status is set to -5 in the database, unless the client is exiting.
+ *
+ * @param prepared_job the prepared job, the job member has to be set to the claimed job.
+ * @return true on success, false on errors
  */
-string build_watcher_command(const Job& job) {
-    string watcher_out_file = get_watcher_output_filename(job);
-    string solver_out_file = get_solver_output_filename(job);
-    ostringstream cmd;
-    cmd << absolute_path("./runsolver");
-    cmd << " -w \"" << watcher_out_file << "\"";
-    cmd << " -o \"" << solver_out_file << "\"";
-    
-    if (job.CPUTimeLimit != -1) cmd << " -C " << job.CPUTimeLimit;
-    if (job.wallClockTimeLimit != -1) cmd << " -W " << job.wallClockTimeLimit;
-    if (job.memoryLimit != -1) cmd << " -M " << job.memoryLimit;
-    if (job.stackSizeLimit != -1) cmd << " -S " << job.stackSizeLimit;
-    return cmd.str();
-}
+bool prepare_job(PreparedJob& prepared_job) {
+    Job& job = prepared_job.job;
+    Solver& solver = prepared_job.solver;
+    Instance& instance = prepared_job.instance;
+    string& instance_binary = prepared_job.instance_binary;
+    string& solver_base_path = prepared_job.solver_base_path;
+
+    ostringstream oss;
+    oss << "Host information:" << endl;
+    oss << setw(30) << "Number of cores: " << host_info.num_cores << endl;
+    oss << setw(30) << "Number of threads: " << host_info.num_threads << endl;
+    oss << setw(30) << "Hyperthreading: " << host_info.hyperthreading << endl;
+    oss << setw(30) << "Turboboost: " << host_info.turboboost << endl;
+    oss << setw(30) << "CPU model: " << host_info.cpu_model << endl;
+    oss << setw(30) << "Cache size (KB): " << host_info.cache_size << endl;
+    oss << setw(30) << "Total memory (MB): " << host_info.memory / 1024 / 1024 << endl;
+    oss << setw(30) << "Free memory (MB): " << host_info.free_memory / 1024 / 1024 << endl << endl;
+    job.launcherOutput = oss.str();
+
+    update_preparing_job(job);
+
+    log_message(LOG_DEBUG, "receiving solver informations");
+    if (!get_solver(job, solver)) {
+        log_error(AT, "Could not receive solver information.");
+        job.status = -5;
+        job.launcherOutput += get_log_tail();
+        update_preparing_job(job);
+        return false;
+    }
+    job.Solver_idSolver = solver.idSolver;
+    job.idSolverBinary = solver.idSolverBinary;
+
+    log_message(LOG_DEBUG, "receiving instance informations");
+    if (!get_instance(job, instance)) {
+        log_error(AT, "Could not receive instance information.");
+        job.status = -5;
+        job.launcherOutput += get_log_tail();
+        update_preparing_job(job);
+        return false;
+    }
+
+    log_message(LOG_DEBUG, "checking instance binary");
+    if (!get_instance_binary(instance, instance_binary)) {
+        log_error(AT, "Could not receive instance binary.");
+        job.status = -5;
+        job.launcherOutput += get_log_tail();
+        update_preparing_job(job);
+        return false;
+    }
+    log_message(LOG_DEBUG, "checking solver binary");
+    if (!get_solver_binary(solver, solver_base_path)) {
+        log_error(AT, "Could not receive solver binary.");
+        job.status = -5;
+        job.launcherOutput += get_log_tail();
+        update_preparing_job(job);
+        return false;
+    }
+
+    log_message(LOG_IMPORTANT, "Solver binary at %s", solver_base_path.c_str());
+    log_message(LOG_IMPORTANT, "Instance binary at %s", instance_binary.c_str());
+
+    if (get_solver_config_params(job.idSolverConfig, prepared_job.parameters) != 1) {
+        log_error(AT, "Could not receive solver config parameters");
+        job.status = -5;
+        job.launcherOutput = get_log_tail();
+        update_preparing_job(job);
+        return false;
+    }
+
+    int num_cpus = 0;
+    if (!solver_config_cpus || !get_solver_config_cpus(job.idSolverConfig, num_cpus) || num_cpus <= 0) {
+        map<int, int>::const_iterator it = cpus_per_job_by_grid_queue.find(job.computeQueue);
+        num_cpus = it != cpus_per_job_by_grid_queue.end() ? it->second : default_cpus_per_job;
+    }
+    if (num_cpus > grid_queue_cpus) {
+        log_message(LOG_IMPORTANT, "[Job %d] Job needs %d CPUs, the client only has %d. Using %d CPUs.",
+                    job.idJob, num_cpus, grid_queue_cpus, grid_queue_cpus);
+        num_cpus = grid_queue_cpus;
+    }
+    job.numCPUs = num_cpus;
+
+    prepared_job.predicted_runtime = predict_runtime(job);
+    if (prepared_job.predicted_runtime >= 0) {
+        log_message(LOG_DEBUG, "[Job %d] Predicted run time: %f s", job.idJob, prepared_job.predicted_runtime);
+    }
+
+    local_resources.instance_ids.insert(job.idInstance);
+    local_resources.solver_binary_ids.insert(job.idSolverBinary);
+    return true;
+}
+
+/**
+ * Returns the L3 job limit of the grid queue, 0 if there's none.
+ */
+static int get_l3_job_limit(int grid_queue_id) {
+    map<int, int>::iterator it = l3_job_limit_by_grid_queue.find(grid_queue_id);
+    if (it == l3_job_limit_by_grid_queue.end()) {
+        it = l3_job_limit_by_grid_queue.find(0);
+    }
+    return it == l3_job_limit_by_grid_queue.end() ? 0 : it->second;
+}
+
+/**
+ * Counts the running jobs on each L3 cache. A job whose PUs belong to several caches counts for each of them.
+ *
+ * @param jobs_by_l3_cache map the number of jobs is stored in by L3 cache
+ */
+static void count_jobs_by_l3_cache(map<int, int>& jobs_by_l3_cache) {
+    for (vector<Worker>::iterator it = workers.begin(); it != workers.end(); ++it) {
+        if (!it->used) continue;
+        set<int> caches;
+        for (set<int>::iterator pu = it->core_ids.begin(); pu != it->core_ids.end(); ++pu) {
+            caches.insert(pu_l3_caches[*pu]);
+        }
+        for (set<int>::iterator cache = caches.begin(); cache != caches.end(); ++cache) {
+            jobs_by_l3_cache[*cache]++;
+        }
+    }
+}
+
+/**
+ * Determines the PUs of pu_order that a job of the grid queue may be pinned to: the free PUs
+ * whose L3 cache is shared by fewer running jobs than the L3 job limit of the grid queue.
+ *
+ * @param grid_queue_id the grid queue of the job
+ * @param jobs_by_l3_cache the number of running jobs by L3 cache, see count_jobs_by_l3_cache()
+ * @param allowed vector that is set to whether each PU of pu_order may be used
+ * @return the number of PUs that may be used
+ */
+static int get_allowed_pus(int grid_queue_id, map<int, int>& jobs_by_l3_cache, vector<bool>& allowed) {
+    int limit = get_l3_job_limit(grid_queue_id);
+    int count = 0;
+    allowed.assign(pu_order.size(), false);
+    for (unsigned int i = 0; i < pu_order.size(); i++) {
+        allowed[i] = !pu_used[i] && (limit == 0 || jobs_by_l3_cache[pu_l3_caches[pu_order[i]]] < limit);
+        if (allowed[i]) count++;
+    }
+    return count;
+}
+
+/**
+ * Try to start a job in the passed worker slot.
+ * The job is taken from the jobs that were claimed and prepared by the prefetch thread.
+ * runsolver is started directly with posix_spawn(), see spawn_process(). The worker slot is
+ * set to used and the details of the started job are stored in the worker aswell.
+ *
+ * @param worker the worker slot which should manage the job run.
+ * @param max_memory_limit the maximum memory limit (MB) of the job, see get_admissible_memory()
+ * @param max_cpus the maximum number of CPUs of the job
+ * @return 1 on success, 0 if there are no prepared jobs, -1 if no prepared job fits
+ */
+int start_job(Worker& worker, int max_memory_limit, int max_cpus) {
+    PreparedJob prepared_job;
+    // jobs of grid queues with an L3 job limit may only use some of the free CPUs
+    map<int, int> max_cpus_by_grid_queue;
+    if (!pu_order.empty() && !l3_job_limit_by_grid_queue.empty()) {
+        map<int, int> jobs_by_l3_cache;
+        count_jobs_by_l3_cache(jobs_by_l3_cache);
+        vector<bool> allowed;
+        for (vector<int>::iterator it = grid_queue_ids.begin(); it != grid_queue_ids.end(); ++it) {
+            if (get_l3_job_limit(*it) > 0) {
+                max_cpus_by_grid_queue[*it] = get_allowed_pus(*it, jobs_by_l3_cache, allowed);
+            }
+        }
+    }
+    defer_signals();
+    int got_job = prefetch_pop_job(prepared_job, max_memory_limit, max_cpus, max_cpus_by_grid_queue);
+    // keep track of the job until a worker slot is actually assigned. This should prevent jobs from
+    // keeping the status running if the client is killed (by other means than messages) while launching.
+    if (got_job == 1) launching_job = prepared_job.job;
+    reset_signal_handler();
+    if (got_job != 1) {
+        return got_job;
+    }
+
+    Job& job = prepared_job.job;
+    const Solver& solver = prepared_job.solver;
+    const string& instance_binary = prepared_job.instance_binary;
+    const string& solver_base_path = prepared_job.solver_base_path;
+    reserve_cpus(worker, job);
+
+    vector<string> launch_argv;
+    vector<ResourceLimit> limits;
+    string output_filename;
+    if (opt_builtin_watcher) {
+        watcher_get_limits(job, limits);
+        output_filename = get_solver_output_filename(job);
+    } else {
+        build_watcher_argv(job, launch_argv);
+        launch_argv.push_back("--");
+    }
+    split_words(sandbox_command, launch_argv);
+    ostringstream tempfiles_path;
+    tempfiles_path << tempfiles_base_path << "/" << job.idJob << "/";
+    if (!create_tempdir(tempfiles_path.str(), tempfiles_size_limit)) {
+        log_error(AT, "Could not create temporary files directory for solver");
+    }
+    build_solver_argv(job, solver, solver_base_path, instance_binary, tempfiles_path.str(), prepared_job.parameters, launch_argv);
+    string launch_command = join_argv(launch_argv);
+    log_message(LOG_IMPORTANT, "Launching job with: %s", launch_command.c_str());
+
+    // write some details about the job to the launcher output column
+    ostringstream oss;
+    oss << job.launcherOutput;
+    oss << endl << endl;
+    oss << "Job details:" << endl;
+    oss << setw(30) << "idJob: " << job.idJob << endl;
+    oss << setw(30) << "Solver: " << solver.solver_name << endl;
+    oss << setw(30) << "Binary: " << solver.binaryName << endl;
+    oss << setw(30) << "Launch command: " << launch_command << endl;
+    oss << setw(30) << "Seed: " << job.seed << endl;
+    oss << setw(30) << "CPUs: " << job.numCPUs << endl;
+    if (!worker.core_ids.empty()) {
+        oss << setw(30) << "PUs: " << join_ids(worker.core_ids) << endl;
+    }
+    if (!worker.numa_nodes.empty()) {
+        oss << setw(30) << "NUMA node(s): " << join_ids(worker.numa_nodes) << endl;
+    }
+    oss << setw(30) << "Instance: " << prepared_job.instance.name << endl;
+    job.launcherOutput = oss.str();
+
+    const set<int>& cpu_ids = worker.core_ids;
+    // runsolver (or the solver itself with the built-in watcher) is started directly without a
+    // shell. If it can't be started, the job is set to client error and the worker slot stays free.
+    int cgroup_fd = -1;
+    worker.cgroup = "";
+    if (opt_cgroup != "") {
+        // each job gets a new cgroup, the janitor thread may still be removing the cgroup of the previous job
+        static int num_cgroups = 0;
+        static bool cgroup_failed = false;
+        ostringstream cgroup;
+        cgroup << opt_cgroup << "/job" << job.idJob << "-" << ++num_cgroups;
+        cgroup_fd = cgroup_prepare(cgroup.str(), job, cpu_ids, worker.numa_nodes);
+        if (cgroup_fd != -1) {
+            worker.cgroup = cgroup.str();
+        } else {
+            if (!cgroup_failed) {
+                log_message(LOG_IMPORTANT, "WARNING: Could not prepare cgroup %s, running job %d and further jobs whose "
+                            "cgroup can't be prepared without cgroup limits and accounting.", cgroup.str().c_str(), job.idJob);
+                cgroup_failed = true;
+            }
+            janitor_remove_cgroup(cgroup.str());
+        }
+    }
+    defer_signals();
+    pid_t pid = spawn_process(launch_argv, absolute_path(solver_base_path), cpu_ids, worker.numa_nodes, environp, limits, output_filename, cgroup_fd,
+                              opt_perf_counters ? &worker.perf_counter_fds : NULL);
+    if (cgroup_fd != -1) {
+        close(cgroup_fd);
+    }
+    if (pid == -1) {
+        perf_counters_close(worker.perf_counter_fds);
+        janitor_remove(tempfiles_path.str());
+        if (!worker.cgroup.empty()) {
+            janitor_remove_cgroup(worker.cgroup);
+        }
+        worker.current_job = job;
+        release_cpus(worker);
+        job.status = -5;
+        job.launcherOutput += get_log_tail();
+        methods.db_update_job(job);
+        launching_job.idJob = 0;
+        reset_signal_handler();
+        return 0;
+    }
+    t_started_last_job = time(NULL);
+    worker.start_time = monotonic_time();
+    worker.exceeded_limit = 0;
+    worker.kill_time = 0;
+    worker.cpu_time = 0;
+    worker.used = true;
+    worker.current_job = job; // this is a copy of the job, not a reference or pointer
+    worker.current_job.instance_file_name = instance_binary;
+    worker.pid = pid;
+    if (opt_sample_interval > 0) {
+        sampler_add_job(job.idJob, pid, worker.cgroup);
+    }
+    launching_job.idJob = 0; // 0 means there's no job that is about to be launched
+    // this ends the lease of the job in the database
+    methods.db_update_start_time(job.idJob);
+    methods.increment_core_count(client_id, job.idExperiment);
+    update_cached_cpu_count(job.idExperiment, 1);
+    reset_signal_handler();
+    return 1;
+}
 
 /**
- * Builds the solver launch command given the list of parameter instances.
+ * Determines the largest memory limit (MB) a job may have to be started next.
+ * The memory limits of the running jobs are committed against the physical memory
+ * of the host and the next job additionally has to fit into the memory that is
+ * currently available on the system. Jobs without memory limit count as 0 MB.
+ * If no job is running, any job may be started so that large jobs can't starve.
+ *
+ * @return the maximum memory limit in MB or -1 if no job should be started at all
+ */
+int get_admissible_memory() {
+    long long committed = 0;
+    bool any_running_jobs = false;
+    for (vector<Worker>::iterator it = workers.begin(); it != workers.end(); ++it) {
+        if (it->used) {
+            any_running_jobs = true;
+            if (it->current_job.memoryLimit > 0) committed += it->current_job.memoryLimit;
+        }
+    }
+    if (!any_running_jobs) {
+        return INT_MAX;
+    }
+    long long total = host_info.memory / 1024 / 1024;
+    long long available = get_available_system_memory() / 1024 / 1024;
+    if (available < MIN_AVAILABLE_MEMORY || committed >= total) {
+        return -1;
+    }
+    long long admissible = min(total - committed, available);
+    return admissible > INT_MAX ? INT_MAX : (int)admissible;
+}
+
+/**
+ * Reserves the job's number of the free CPUs for the job in the passed worker slot.
+ * If the solvers are bound to processing units, the job is pinned to the smallest range
+ * of neighbouring free PUs that is large enough, so that the threads of a job share caches.
+ * With the scatter placement policy the range on the L3 caches with the fewest running jobs
+ * is preferred. PUs on L3 caches that reached the L3 job limit of the job's grid queue aren't used.
+ * If the free PUs are too fragmented, the first free PUs are used.
+ *
+ * @param worker the worker slot of the job
+ * @param job the job
+ */
+void reserve_cpus(Worker& worker, const Job& job) {
+    int num_cpus = job.numCPUs;
+    free_cpus -= num_cpus;
+    pthread_mutex_lock(&grid_queue_mutex);
+    running_cpus_by_grid_queue[job.computeQueue] += num_cpus;
+    pthread_mutex_unlock(&grid_queue_mutex);
+    worker.core_ids.clear();
+    worker.numa_nodes.clear();
+    if (pu_order.empty()) {
+        return;
+    }
+    map<int, int> jobs_by_l3_cache;
+    count_jobs_by_l3_cache(jobs_by_l3_cache);
+    vector<bool> allowed;
+    get_allowed_pus(job.computeQueue, jobs_by_l3_cache, allowed);
+    int best_start = -1, best_length = 0, best_load = 0;
+    for (int i = 0; i < (int)allowed.size(); ) {
+        if (!allowed[i]) {
+            i++;
+            continue;
+        }
+        int length = 0;
+        while (i + length < (int)allowed.size() && allowed[i + length]) length++;
+        // the scatter policy considers every position within the range, the others its start
+        int last_start = opt_placement == PLACEMENT_SCATTER ? i + length - num_cpus : i;
+        for (int start = i; length >= num_cpus && start <= last_start; start++) {
+            int load = 0;
+            if (opt_placement == PLACEMENT_SCATTER) {
+                for (int j = start; j < start + num_cpus; j++) {
+                    load = max_(load, jobs_by_l3_cache[pu_l3_caches[pu_order[j]]]);
+                }
+            }
+            if (best_start == -1 || load < best_load || (load == best_load && length < best_length)) {
+                best_start = start;
+                best_length = length;
+                best_load = load;
+            }
+        }
+        i += length;
+    }
+    for (int i = max_(best_start, 0); i < (int)allowed.size() && (int)worker.core_ids.size() < num_cpus; i++) {
+        if (allowed[i]) {
+            pu_used[i] = true;
+            worker.core_ids.insert(pu_order[i]);
+            if (pu_nodes.count(pu_order[i])) {
+                worker.numa_nodes.insert(pu_nodes[pu_order[i]]);
+            }
+        }
+    }
+}
+
+/**
+ * Releases the CPUs of the job of the passed worker slot.
+ *
+ * @param worker the worker slot of the job
+ */
+void release_cpus(Worker& worker) {
+    free_cpus += worker.current_job.numCPUs;
+    pthread_mutex_lock(&grid_queue_mutex);
+    running_cpus_by_grid_queue[worker.current_job.computeQueue] -= worker.current_job.numCPUs;
+    pthread_mutex_unlock(&grid_queue_mutex);
+    for (int i = 0; i < (int)pu_order.size(); i++) {
+        if (worker.core_ids.count(pu_order[i])) {
+            pu_used[i] = false;
+        }
+    }
+    worker.core_ids.clear();
+    worker.numa_nodes.clear();
+}
+
+/**
+ * Build a filename for the watcher output file.
+ * @param job the job which to build the watcher output filename for.
+ * @return a filename
+ */
+string get_watcher_output_filename(const Job& job) {
+    ostringstream oss;
+    oss << result_path << "/" << database_name << "_" << job.idJob << ".w";
+    return oss.str();
+}
+
+/**
+ * Build a filename for the solver output file.
+ * @param job the job which to build the solver output filename for.
+ * @return a filename
+ */
+string get_solver_output_filename(const Job& job) {
+    ostringstream oss;
+    oss << result_path << "/" << database_name << "_" << job.idJob << ".o";
+    return oss.str();
+}
+
+/**
+ * Formats an integer as decimal string.
+ */
+static string int_to_string(int value) {
+    ostringstream oss;
+    oss << value;
+    return oss.str();
+}
+
+/**
+ * Builds the arguments of the watcher up to the point where the solver binary and
+ * parameters should follow. The computational limits such as time and memory
+ * limits are taken from the job. If the value of such a limit is -1, then no
+ * limit is imposed.
+ * 
+ * e.g. {"/path/runsolver", "-w", "abc.w", "-o", "abc.o", "-C", "1000"}
+ * 
+ * @param job The job that the watcher should launch
+ * @param argv vector the arguments are appended to
+ */
+void build_watcher_argv(const Job& job, vector<string>& argv) {
+    argv.push_back(absolute_path("./runsolver"));
+    argv.push_back("-w");
+    argv.push_back(get_watcher_output_filename(job));
+    argv.push_back("-o");
+    argv.push_back(get_solver_output_filename(job));
+    
+    if (job.CPUTimeLimit != -1) {
+        argv.push_back("-C");
+        argv.push_back(int_to_string(job.CPUTimeLimit));
+    }
+    if (job.wallClockTimeLimit != -1) {
+        argv.push_back("-W");
+        argv.push_back(int_to_string(job.wallClockTimeLimit));
+    }
+    if (job.memoryLimit != -1) {
+        argv.push_back("-M");
+        argv.push_back(int_to_string(job.memoryLimit));
+    }
+    if (job.stackSizeLimit != -1) {
+        argv.push_back("-S");
+        argv.push_back(int_to_string(job.stackSizeLimit));
+    }
+}
+
+/**
+ * Appends <code>str</code> to the arguments, either as a new argument or
+ * attached to the last argument.
+ */
+static void append_argument(vector<string>& argv, const string& str, bool new_argument) {
+    if (new_argument || argv.empty()) {
+        argv.push_back(str);
+    } else {
+        argv.back() += str;
+    }
+}
+
+/**
+ * Builds the solver arguments given the list of parameter instances.
  * The parameter vector should be passed in pre-sorted by the `order` column.
  * Parameters named `seed` and `instance` are special parameters that are always
  * substituted by the instance and seed values of the current job.
+ * A parameter starts a new argument unless it is attached to the previous one, its
+ * value is a separate argument if there's a space between prefix and value.
+ * The run command of the solver (e.g. "java -jar") is split at whitespace.
  * 
- * Example: "./solvers/TNM -seed 13456 -instance ./instances/in1.cnf -p1 1.2"
+ * Example: {"./solvers/TNM", "-seed", "13456", "-instance", "./instances/in1.cnf", "-p1", "1.2"}
  * 
  * @param job the job that should be run
  * @param solver_binary_filename the filename of the solver binary
  * @param instance_binary_filename the filename of the instance
  * @param parameters a vector of Parameter instances that are used to build the command line arguments
- * @return command line string that runs the solver on the given instance
+ * @param argv vector the arguments are appended to
  */
-string build_solver_command(const Job& job, const Solver& solver, const string& solver_base_path, 
-                            const string& instance_binary_filename, const string& tempfiles_path,
-                            const vector<Parameter>& parameters) {
-    ostringstream cmd;
-    cmd << solver.runCommand;
-    if (solver.runCommand != "") cmd << " ";
-    cmd << "\"" << solver_base_path << "/" << solver.runPath << "\" ";
+void build_solver_argv(const Job& job, const Solver& solver, const string& solver_base_path,
+                       const string& instance_binary_filename, const string& tempfiles_path,
+                       const vector<Parameter>& parameters, vector<string>& argv) {
+    split_words(solver.runCommand, argv);
+    argv.push_back(solver_base_path + "/" + solver.runPath);
     for (vector<Parameter>::const_iterator p = parameters.begin(); p != parameters.end(); ++p) {
-        if (!p->attachToPrevious) cmd << " ";
-        cmd << p->prefix;
+        bool new_argument = !p->attachToPrevious;
         if (p->prefix != "") {
-            if (p->space) { // space between prefix and value?
-                cmd << " ";
-            }
+            append_argument(argv, p->prefix, new_argument);
+            new_argument = p->space; // space between prefix and value?
         }
         if (str_lower(p->name) == "seed") {
-            cmd << job.seed;
+            append_argument(argv, int_to_string(job.seed), new_argument);
         }
         else if (str_lower(p->name) == "instance") {
-            cmd << "\"" << instance_binary_filename << "\"";
+            append_argument(argv, instance_binary_filename, new_argument);
         }
         else if (str_lower(p->name) == "tempdir") {
-        	cmd << "\"" << tempfiles_path << "/\"";
+            append_argument(argv, tempfiles_path + "/", new_argument);
         }
-        /*else if (p->name == "db_host") {
-            cmd << get_db_host();
+        else if (p->hasValue && p->value != "") {
+            append_argument(argv, p->value, new_argument);
         }
-        else if (p->name == "db_port") {
-            cmd << get_db_port();
-        }
-        else if (p->name == "db_db") {
-            cmd << get_db();
-        }
-        else if (p->name == "db_username") {
-            cmd << get_db_username();
-        }
-        else if (p->name == "db_password") {
-            cmd << get_db_password();
-        }*/
-        else {
-            if (p->hasValue) {
-                cmd << p->value;
+    }
+}
+
+/**
+ * Splits <code>str</code> at whitespace and appends the words to <code>words</code>.
+ */
+void split_words(const string& str, vector<string>& words) {
+    istringstream iss(str);
+    string word;
+    while (iss >> word) {
+        words.push_back(word);
+    }
+}
+
+/**
+ * Joins the ids to a comma separated list, e.g. "0,1,4".
+ */
+string join_ids(const set<int>& ids) {
+    ostringstream oss;
+    for (set<int>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+        if (it != ids.begin()) oss << ',';
+        oss << *it;
+    }
+    return oss.str();
+}
+
+/**
+ * Joins the arguments to a command line for logging. Arguments that contain
+ * whitespace or quotes are quoted with single quotes.
+ *
+ * @param argv the arguments
+ * @return a command line string
+ */
+string join_argv(const vector<string>& argv) {
+    string cmd;
+    for (vector<string>::const_iterator it = argv.begin(); it != argv.end(); ++it) {
+        if (it != argv.begin()) cmd += " ";
+        if (it->empty() || it->find_first_of(" \t\n'\"\\") != string::npos) {
+            cmd += "'";
+            for (string::const_iterator c = it->begin(); c != it->end(); ++c) {
+                if (*c == '\'') cmd += "'\\''";
+                else cmd += *c;
             }
+            cmd += "'";
+        } else {
+            cmd += *it;
         }
     }
-    return cmd.str();
+    return cmd;
 }
 
 /**
@@ -1202,34 +1960,10 @@ bool parse_watcher_line(istream &stream, const string prefix, float& value) {
 }
 
 /**
- * Process the results of a given job. This includes
- * parsing the watcher (runsolver) output to determine if the solver
- * was terminated due to exceeding a computation limit or exited normally.
- * 
- * If it exited normally the verifier is run on the solver's output
- * and the instance used to determine a result code.
- * 
- * Notice: The results are not written back to the database by this function.
- * This should be done after calling this function.
- * 
- * @param job The job of which the results should be processed.
- * @return 1 on success, 0 on errors
+ * Sets the status, result code and times of the job from the output of runsolver.
+ * The job is successful (status 1) if runsolver reported its times and no limit was exceeded.
  */
-int process_results(Job& job) {    
-    log_message(LOG_DEBUG, "Starting to process results of job %d", job.idJob);
-	string watcher_output_filename = get_watcher_output_filename(job);
-	string solver_output_filename = get_solver_output_filename(job);
-    
-	log_message(LOG_DEBUG, "Loading watcher output");
-	if (!load_file_string(watcher_output_filename, job.watcherOutput)) {
-		log_error(AT, "Could not read watcher output file.");
-		return 0;
-	}
-	log_message(LOG_DEBUG, "Loading solver output");
-	if (!load_file_binary(solver_output_filename, &job.solverOutput, &job.solverOutput_length, 512*1024*1024)) {
-		log_error(AT, "Could not read solver output file.");
-		return 0;
-	}
+void parse_watcher_output(Job& job) {
 	log_message(LOG_DEBUG, "Starting to process results");
 
     stringstream ss(job.watcherOutput);
@@ -1253,21 +1987,21 @@ int process_results(Job& job) {
         job.status = 21;
         job.resultCode = -21;
         log_message(LOG_IMPORTANT, "[Job %d] CPU time limit exceeded", job.idJob);
-        return 1;
+        return;
     }
     ss.clear(); ss.seekg(0);
     if (find_in_stream(ss, "Maximum wall clock time exceeded:")) {
         job.status = 22;
         job.resultCode = -22;
         log_message(LOG_IMPORTANT, "[Job %d] Wall clock time limit exceeded", job.idJob);
-        return 1;
+        return;
     }
     ss.clear(); ss.seekg(0);
     if (find_in_stream(ss, "Maximum VSize exceeded:")) {
         job.status = 23;
         job.resultCode = -23;
         log_message(LOG_IMPORTANT, "[Job %d] Memory limit exceeded", job.idJob);
-        return 1;
+        return;
     }
 
     // TODO: stack size limit
@@ -1280,12 +2014,12 @@ int process_results(Job& job) {
 			job.status = 21;
 			job.resultCode = -21;
 			log_message(LOG_IMPORTANT, "[Job %d] CPU time limit exceeded (received SIGXCPU)", job.idJob);
-			return 1;
+			return;
 		}
 		job.status = -3;
 		job.resultCode = -(300+signal);
 		log_message(LOG_IMPORTANT, "[Job %d] Received signal %d", job.idJob, signal);
-		return 1;
+		return;
     }
     
     ss.clear(); ss.seekg(0);
@@ -1293,7 +2027,7 @@ int process_results(Job& job) {
         job.status = -3;
         job.resultCode = -398;
         log_message(LOG_IMPORTANT, "[Job %d] runsolver couldn't execute solver binary", job.idJob);
-        return 1;
+        return;
     }
     
     ss.clear(); ss.seekg(0);
@@ -1301,15 +2035,51 @@ int process_results(Job& job) {
         job.status = -3;
         job.resultCode = -399;
         log_message(LOG_IMPORTANT, "[Job %d] runsolver couldn't execute solver binary", job.idJob);
-        return 1;
+        return;
     }
+}
+
+/**
+ * Process the results of a given job. This includes
+ * parsing the watcher (runsolver) output to determine if the solver
+ * was terminated due to exceeding a computation limit or exited normally.
+ * With the built-in watcher this was already determined when the solver terminated.
+ * 
+ * If it exited normally the verifier is run on the solver's output
+ * and the instance used to determine a result code.
+ * 
+ * Notice: The results are not written back to the database by this function.
+ * This should be done after calling this function.
+ * 
+ * @param job The job of which the results should be processed.
+ * @return 1 on success, 0 on errors
+ */
+int process_results(Job& job) {    
+    log_message(LOG_DEBUG, "Starting to process results of job %d", job.idJob);
+	string watcher_output_filename = opt_builtin_watcher ? "" : get_watcher_output_filename(job);
+	string solver_output_filename = get_solver_output_filename(job);
+    
+	if (!opt_builtin_watcher) {
+		log_message(LOG_DEBUG, "Loading watcher output");
+		if (!load_file_string(watcher_output_filename, job.watcherOutput)) {
+			log_error(AT, "Could not read watcher output file.");
+			return 0;
+		}
+	}
+	log_message(LOG_DEBUG, "Loading solver output");
+	if (!load_file_binary(solver_output_filename, &job.solverOutput, &job.solverOutput_length, 512*1024*1024)) {
+		log_error(AT, "Could not read solver output file.");
+		return 0;
+	}
+	// the built-in watcher already set the status and times of the job
+	if (!opt_builtin_watcher) {
+		parse_watcher_output(job);
+	}
 
     if (job.status == 1) {
     	log_message(LOG_IMPORTANT, "[Job %d] Successful!", job.idJob);
 
-    	char old_wd[PATH_MAX];
     	if (job.Cost_idCost != 0) {
-			getcwd(old_wd, PATH_MAX);
 			log_message(LOG_IMPORTANT, "[Job %d] running cost calculation!", job.idJob);
 			CostBinary cost_binary;
 			if (get_cost_binary_details(cost_binary, job.Solver_idSolver, job.Cost_idCost) == 0) {
@@ -1322,44 +2092,28 @@ int process_results(Job& job) {
 					job.launcherOutput += "\nCould not get cost binary.\n";
 				} else {
 					string cost_binary_command = build_cost_command(job, cost_binary, cost_binary_base_path, solver_output_filename, job.instance_file_name);
-					if (chdir(cost_binary_base_path.c_str())) return 0; // TODO: do something on failure
 					if (cost_binary_command != "") {
-						FILE* cost_fd = popen(cost_binary_command.c_str(), "r");
-						if (cost_fd == NULL) {
+						// the cost binary runs in its own directory, the working directory
+						// of the client is shared by all threads and must not be changed
+						char* cost_binary_output;
+						unsigned long len;
+						int stat;
+						if (!run_command(cost_binary_command, cost_binary_base_path, &cost_binary_output, &len, &stat)) {
 							log_error(AT, "Couldn't start cost_binary: %s", cost_binary_command.c_str());
 							job.launcherOutput += "\nCouldn't start cost binary: " + cost_binary_command + "\n\n";
 							job.launcherOutput += get_log_tail();
 						}
 						else {
-							log_message(LOG_DEBUG, "Started cost binary %s", cost_binary_command.c_str());
-							char buf[256];
-							char* cost_binary_output = (char*)malloc(256 * sizeof(char));
-							size_t max_len = 256;
-							size_t len = 0;
-							size_t n_read;
-							while ((n_read = fread(buf, sizeof(char), 256, cost_fd)) > 0) {
-								if (len + n_read >= max_len) {
-									cost_binary_output = (char*)realloc(cost_binary_output, max_len * 2);
-									max_len *= 2;
-								}
-								for (size_t i = 0; i < n_read; i++) {
-									cost_binary_output[len+i] = buf[i];
-								}
-								len += n_read;
-							}
-                            cost_binary_output[len] = 0;
+							log_message(LOG_DEBUG, "Ran cost binary %s", cost_binary_command.c_str());
 							istringstream cbi(cost_binary_output);
 							cbi >> job.cost;
                             log_message(LOG_IMPORTANT, "[Job %d] cost str: %s", job.idJob, cost_binary_output);
                             log_message(LOG_IMPORTANT, "[Job %d] cost: %f", job.idJob, job.cost);
 							free(cost_binary_output);
-
-							pclose(cost_fd);
 						}
 					}
 				}
 			}
-			if (chdir(old_wd)) return 0; // TODO: do something on failure
     	}
 
 
@@ -1383,17 +2137,15 @@ int process_results(Job& job) {
 
     	string verifier_command = build_verifier_command(verifier, verifier_base_path, solver_output_filename,
     			job.instance_file_name, watcher_output_filename, ""); // TODO: launcher output
-        getcwd(old_wd, PATH_MAX);
-        if (chdir(verifier_base_path.c_str())) return 0; // TODO: do something on failure
 
-
-        // Run the verifier (if so configured) via popen which returns a file descriptor of
-        // the verifier's stdout. Verifier output is read and stored in
-        // the verifierOuput field of the job. The integer that is written after the last '\n'
-        // in the verifier output is assumed to be the result code.
+        // Run the verifier (if so configured) in its directory and read its stdout.
+        // Verifier output is stored in the verifierOuput field of the job. The integer
+        // that is written after the last '\n' in the verifier output is assumed to be the result code.
         if (verifier_command != "") {
-            FILE* verifier_fd = popen(verifier_command.c_str(), "r");
-            if (verifier_fd == NULL) {
+            char* verifier_output;
+            unsigned long len;
+            int stat;
+            if (!run_command(verifier_command, verifier_base_path, &verifier_output, &len, &stat)) {
                 log_error(AT, "Couldn't start verifier: %s", verifier_command.c_str());
                 job.launcherOutput += "\nCouldn't start verifier: " + verifier_command + "\n\n";
                 job.launcherOutput += get_log_tail();
@@ -1401,30 +2153,10 @@ int process_results(Job& job) {
                 // 0 = unknown
             }
             else {
-                log_message(LOG_DEBUG, "Started verifier %s", verifier_command.c_str());
-                char buf[256];
-                char* verifier_output = (char*)malloc(256 * sizeof(char));
-                size_t max_len = 256;
-                size_t len = 0;
-                size_t n_read;
-                // read the output from the verifier's stdout into the temporary char* verifier_output
-                while ((n_read = fread(buf, sizeof(char), 256, verifier_fd)) > 0) {
-                    if (len + n_read >= max_len) {
-                        verifier_output = (char*)realloc(verifier_output, max_len * 2);
-                        max_len *= 2;
-                    }
-                    for (size_t i = 0; i < n_read; i++) {
-                        verifier_output[len+i] = buf[i];
-                    }
-                    len += n_read;
-                }
+                log_message(LOG_DEBUG, "Ran verifier %s", verifier_command.c_str());
                 // set the job's verifier output attributes (data + length)
                 job.verifierOutput_length = len;
-                job.verifierOutput = (char*) malloc(len * sizeof(char));
-                memcpy(job.verifierOutput, verifier_output, len);
-                free(verifier_output);
-                
-                int stat = pclose(verifier_fd);
+                job.verifierOutput = verifier_output;
                 job.verifierExitCode = WEXITSTATUS(stat); // exit code of the verifier
                 
                 // read result code
@@ -1441,8 +2173,6 @@ int process_results(Job& job) {
                 log_message(LOG_DEBUG, "Verifier exited with exit code %d", job.verifierExitCode);
             }
         }
-
-        chdir(old_wd); // TODO: this has to be always executed!
     } else {
         log_message(LOG_DEBUG, "[Job %d] Not successful, status code: %d", job.idJob, job.status);
     }
@@ -1450,10 +2180,60 @@ int process_results(Job& job) {
     return 1;
 }
 
+/**
+ * Processes the results of a job whose watcher terminated, writes them to the database and
+ * queues the output files and the temporary directory of the job for removal by the janitor thread.
+ * Called by the result threads, see results.cc.
+ *
+ * @param job the job
+ * @param proc_stat the status of the watcher process as returned by waitpid
+ */
+void finish_job(Job& job, int proc_stat) {
+    if (opt_builtin_watcher) {
+        // the status of the solver process was already evaluated, see watcher_set_results()
+        if (process_results(job) != 1) job.status = -5;
+    }
+    else if (WIFEXITED(proc_stat)) {
+        // normal watcher exit
+        job.watcherExitCode = WEXITSTATUS(proc_stat);
+        if (process_results(job) != 1) job.status = -5;
+    }
+    else {
+        // watcher terminated with a signal
+        job.status = -400 - WTERMSIG(proc_stat);
+        job.resultCode = 0; // unknown result
+    }
+    if (job.oom_killed && job.status != 1 && job.status != 23) {
+        // the kernel killed processes of the job because of the memory limit of its cgroup
+        job.status = 23;
+        job.resultCode = -23;
+        log_message(LOG_IMPORTANT, "[Job %d] Memory limit exceeded (cgroup)", job.idJob);
+    }
+    decrement_core_count(client_id, job.idExperiment);
+    update_cached_cpu_count(job.idExperiment, -1);
+    methods.db_update_job(job);
+    predictor_add_result(job);
+
+    if (job.solverOutput != 0) free(job.solverOutput);
+    if (job.verifierOutput != 0) free(job.verifierOutput);
+    // the files are removed by the janitor thread
+    if (!opt_keep_output) {
+        if (!opt_builtin_watcher) {
+            janitor_remove(get_watcher_output_filename(job));
+        }
+        janitor_remove(get_solver_output_filename(job));
+    }
+    log_message(LOG_DEBUG, "Removing temporary directory of job %d.", job.idJob);
+    ostringstream oss;
+    oss << tempfiles_base_path << "/" << job.idJob;
+    janitor_remove(oss.str());
+}
+
 /**
  * Handles the workers.
- * If a worker child process terminated, the results of its job are 
- * processed and written to the DB.
+ * If a worker child process terminated, the worker is freed and its job is
+ * handed over to the result threads which process the results and write
+ * them to the DB.
  * 
  * @param workers: vector of the workers
  * @return the number of jobs that finished
@@ -1469,57 +2249,42 @@ int handle_workers(vector<Worker>& workers) {
                 exit_client(1);
             }
             int proc_stat;
+            struct rusage usage;
             
-            int pid = waitpid(child_pid, &proc_stat, WNOHANG);
+            int pid = wait4(child_pid, &proc_stat, WNOHANG, &usage);
             if (pid == child_pid) {
-                num_finished++;
-                Job& job = it->current_job;
-                if (WIFEXITED(proc_stat)) {
-                    // normal watcher exit
-                    job.watcherExitCode = WEXITSTATUS(proc_stat);
-                    if (process_results(job) != 1) job.status = -5;
-                    it->used = false;
-                    it->pid = 0;
-
-                    defer_signals();
-                    decrement_core_count(client_id, it->current_job.idExperiment);
-                    methods.db_update_job(job);
-                    reset_signal_handler();
-                }
-                else if (WIFSIGNALED(proc_stat)) {
-                    // watcher terminated with a signal
-                    job.status = -400 - WTERMSIG(proc_stat);
-                    job.resultCode = 0; // unknown result
-                    it->used = false;
-                    it->pid = 0;
-
-                    defer_signals();
-                    decrement_core_count(client_id, it->current_job.idExperiment);
-                    methods.db_update_job(job);
-                    reset_signal_handler();
-                }
-                else {
+                if (!WIFEXITED(proc_stat) && !WIFSIGNALED(proc_stat)) {
                     // TODO: can this happen?
                     log_error(AT, "reached an unexpected point in handle_workers, got proc_stat %d", proc_stat);
                     exit_client(1);
                 }
-                
-                if (WIFEXITED(proc_stat) || WIFSIGNALED(proc_stat)) {
-                    if (it->current_job.solverOutput != 0) free(it->current_job.solverOutput);
-                    if (it->current_job.verifierOutput != 0) free(it->current_job.verifierOutput);
-                    if (!opt_keep_output) {
-                        if (remove(get_watcher_output_filename(job).c_str()) != 0) {
-                            log_message(LOG_IMPORTANT, "Could not remove watcher output file %s", get_watcher_output_filename(job).c_str());
-                        }
-                        if (remove(get_solver_output_filename(job).c_str()) != 0) {
-                            log_message(LOG_IMPORTANT, "Could not remove solver output file %s", get_solver_output_filename(job).c_str());
-                        }
-                    }
-                    log_message(LOG_DEBUG, "Removing temporary directory of this run.");
-                    ostringstream oss;
-                    oss << "rm -rf " << tempfiles_base_path << "/" << job.idJob;
-                    system(oss.str().c_str());
+                num_finished++;
+                double wall_time = monotonic_time() - it->start_time;
+                defer_signals();
+                prefetch_job_finished(wall_time);
+                reset_signal_handler();
+                double cpu_time = it->cpu_time;
+                if (!it->cgroup.empty()) {
+                    cpu_time = max_(cpu_time, finish_cgroup(*it));
                 }
+                if (opt_perf_counters) {
+                    finish_perf_counters(*it, usage);
+                }
+                if (opt_builtin_watcher) {
+                    int exceeded_limit = it->exceeded_limit;
+                    if (exceeded_limit == 0 && it->current_job.oom_killed) exceeded_limit = 23;
+                    watcher_set_results(it->current_job, proc_stat, usage, wall_time, cpu_time, exceeded_limit);
+                }
+                defer_signals();
+                // the sampler mutex must not be held when exit_client() is called by the signal handler
+                if (opt_sample_interval > 0) {
+                    sampler_remove_job(it->current_job);
+                }
+                result_add_job(it->current_job, proc_stat);
+                release_cpus(*it);
+                it->used = false;
+                it->pid = 0;
+                reset_signal_handler();
             }
             if (pid == -1) {
                 log_error(AT, "waitpid returned -1: errno %d", errno);
@@ -1530,6 +2295,139 @@ int handle_workers(vector<Worker>& workers) {
     return num_finished;
 }
 
+/**
+ * Reads the performance counters of the job of the worker slot after it terminated and
+ * appends them to the launcher output of the job. If the context switches couldn't be
+ * counted, they are taken from the resource usage of the job's process and its waited-for children.
+ *
+ * @param worker the worker slot
+ * @param usage the resource usage of the job's process returned by wait4()
+ */
+void finish_perf_counters(Worker& worker, const struct rusage& usage) {
+    Job& job = worker.current_job;
+    PerfCounterValues values;
+    perf_counters_read(worker.perf_counter_fds, values);
+    perf_counters_close(worker.perf_counter_fds);
+    if (values.context_switches < 0) {
+        values.context_switches = usage.ru_nvcsw + usage.ru_nivcsw;
+    }
+    job.instructions = values.instructions;
+    job.cycles = values.cycles;
+    job.llcMisses = values.llc_misses;
+    job.contextSwitches = values.context_switches;
+    long long* counters[] = { &values.instructions, &values.cycles, &values.llc_misses, &values.context_switches };
+    const char* names[] = { "Instructions: ", "Cycles: ", "LLC misses: ", "Context switches: " };
+    ostringstream oss;
+    oss << endl << "Performance counters:" << endl;
+    for (int i = 0; i < 4; i++) {
+        oss << setw(30) << names[i];
+        if (*counters[i] >= 0) {
+            oss << *counters[i] << endl;
+        } else {
+            oss << "n/a" << endl;
+        }
+    }
+    job.launcherOutput += oss.str();
+}
+
+/**
+ * Ends the cgroup of the worker slot after its job terminated: processes that are still
+ * running (e.g. they left the process group of the job) are killed, the resource usage
+ * is appended to the launcher output of the job and the cgroup is removed by the janitor thread.
+ *
+ * @param worker the worker slot
+ * @return the CPU time (s) of the job according to the cgroup, 0 if it couldn't be read
+ */
+double finish_cgroup(Worker& worker) {
+    Job& job = worker.current_job;
+    cgroup_kill(worker.cgroup);
+    CgroupStats stats;
+    if (cgroup_read_stats(worker.cgroup, stats)) {
+        job.oom_killed = stats.oom_kills > 0;
+        ostringstream oss;
+        oss << endl << "Cgroup accounting:" << endl;
+        oss << setw(30) << "CPU time (s): " << stats.cpu_time << endl;
+        oss << setw(30) << "CPU user time (s): " << stats.user_time << endl;
+        oss << setw(30) << "CPU system time (s): " << stats.system_time << endl;
+        oss << setw(30) << "Peak memory (MB): " << stats.memory_peak / 1024.0 / 1024.0 << endl;
+        oss << setw(30) << "I/O read (bytes): " << stats.io_read_bytes << endl;
+        oss << setw(30) << "I/O written (bytes): " << stats.io_write_bytes << endl;
+        oss << setw(30) << "OOM kills: " << stats.oom_kills << endl;
+        job.launcherOutput += oss.str();
+    } else {
+        log_message(LOG_IMPORTANT, "[Job %d] Could not read the accounting of cgroup %s", job.idJob, worker.cgroup.c_str());
+    }
+    janitor_remove_cgroup(worker.cgroup);
+    return stats.cpu_time;
+}
+
+/**
+ * Enforces the limits of the running jobs if the client is the watcher of the jobs.
+ * The wall clock time limit is checked exactly, CPU time and memory usage are summed up
+ * over the process group of each job every WATCHER_CHECK_INTERVAL ms.
+ * Jobs that exceed a limit get SIGTERM and SIGKILL WATCHER_KILL_DELAY seconds later.
+ *
+ * @return time (ms) until the limits have to be checked again, -1 if no job is running
+ */
+int check_job_limits() {
+    static double last_usage_check = 0;
+    bool any_running_jobs = false;
+    for (vector<Worker>::iterator it = workers.begin(); it != workers.end(); ++it) {
+        any_running_jobs |= it->used;
+    }
+    if (!any_running_jobs) {
+        return -1;
+    }
+    double now = monotonic_time();
+    map<pid_t, ProcessGroupUsage> usage;
+    if (now - last_usage_check >= WATCHER_CHECK_INTERVAL / 1000.0) {
+        watcher_get_usage(usage);
+        last_usage_check = now;
+    }
+    double next_check = -1; // time (s) until the next check
+    for (vector<Worker>::iterator it = workers.begin(); it != workers.end(); ++it) {
+        if (!it->used) {
+            continue;
+        }
+        Job& job = it->current_job;
+        if (it->kill_time != 0) {
+            // the job exceeded a limit and is being killed, the solver runs in its own process group
+            if (now - it->kill_time >= WATCHER_KILL_DELAY) {
+                if (it->cgroup.empty() || !cgroup_kill(it->cgroup)) kill(-it->pid, SIGKILL);
+            } else {
+                double t = it->kill_time + WATCHER_KILL_DELAY - now;
+                if (next_check == -1 || t < next_check) next_check = t;
+            }
+            continue;
+        }
+        map<pid_t, ProcessGroupUsage>::const_iterator u = usage.find(it->pid);
+        if (u != usage.end()) {
+            it->cpu_time = u->second.cpu_time;
+        }
+        int exceeded_limit = watcher_check_limits(job, now - it->start_time, u == usage.end() ? NULL : &u->second);
+        if (exceeded_limit != 0) {
+            log_message(LOG_IMPORTANT, "[Job %d] exceeded its limit (status %d), killing it.", job.idJob, exceeded_limit);
+            it->exceeded_limit = exceeded_limit;
+            it->kill_time = now;
+            kill(-it->pid, SIGTERM);
+            if (next_check == -1 || WATCHER_KILL_DELAY < next_check) next_check = WATCHER_KILL_DELAY;
+            continue;
+        }
+        if (job.wallClockTimeLimit > 0) {
+            double t = it->start_time + job.wallClockTimeLimit - now;
+            if (next_check == -1 || t < next_check) next_check = t;
+        }
+        if (job.CPUTimeLimit > 0 || job.memoryLimit > 0) {
+            double t = last_usage_check + WATCHER_CHECK_INTERVAL / 1000.0 - now;
+            if (next_check == -1 || t < next_check) next_check = t;
+        }
+    }
+    if (next_check == -1) {
+        return -1;
+    }
+    return max_((int)ceil(next_check * 1000), 0);
+}
+
 /**
  * Signs off the client from the database (deletes the client's row
  * in the Client table)
@@ -1573,10 +2471,11 @@ bool to_bool(std::string str) {
  * @param password DB password
  * @param database DB name
  * @param port DB port
- * @param grid_queue_id The id of the grid the client is running on.
+ * @param grid_queue_ids The ids of the grids the client is running on, the client signs on to the first one.
+ * @param grid_queue_weights The weights of the grids, 1 if not specified.
  */
 void read_config(string& hostname, string& username, string& password,
-				 string& database, int& port, int& grid_queue_id,
+				 string& database, int& port, vector<int>& grid_queue_ids, vector<int>& grid_queue_weights,
 				 string& jobserver_hostname, int& jobserver_port,
 				 string& sandbox_command, bool& allow_different_solver_binaries) {
 	ifstream configfile(opt_config.c_str());
@@ -1606,7 +2505,16 @@ void read_config(string& hostname, string& username, string& password,
 			database = val;
 		}
 		else if (id == "gridqueue") {
-			grid_queue_id = atoi(val.c_str());
+			// comma separated list of grid queue ids with optional weights: id[:weight][,id[:weight]]*
+			istringstream queues(val);
+			string queue;
+			while (getline(queues, queue, ',')) {
+			    queue = trim_whitespace(queue);
+			    if (queue == "") continue;
+			    size_t colon_pos = queue.find(':');
+			    grid_queue_ids.push_back(atoi(queue.substr(0, colon_pos).c_str()));
+			    grid_queue_weights.push_back(colon_pos == string::npos ? 1 : max_(atoi(queue.substr(colon_pos + 1).c_str()), 0));
+			}
 		}
         else if (id == "port") {
             port = atoi(val.c_str());
@@ -1623,9 +2531,24 @@ void read_config(string& hostname, string& username, string& password,
         else if (id == "solver_tempdir") {
             tempfiles_base_path = val;
         }
+        else if (id == "solver_tempdir_size") {
+            tempfiles_size_limit = max_(atoi(val.c_str()), 0);
+        }
         else if (id == "allow_different_solver_binaries") {
             allow_different_solver_binaries = to_bool(val);
         }
+        else if (id == "l3_job_limit") {
+            // comma separated list of limits for all grid queues or by grid queue id: [id:]limit[,[id:]limit]*
+            istringstream limits(val);
+            string limit;
+            while (getline(limits, limit, ',')) {
+                limit = trim_whitespace(limit);
+                if (limit == "") continue;
+                size_t colon_pos = limit.find(':');
+                int queue_id = colon_pos == string::npos ? 0 : atoi(limit.substr(0, colon_pos).c_str());
+                l3_job_limit_by_grid_queue[queue_id] = max_(atoi(limit.substr(colon_pos == string::npos ? 0 : colon_pos + 1).c_str()), 1);
+            }
+        }
 	}
 	configfile.close();
 }
@@ -1639,9 +2562,23 @@ void read_config(string& hostname, string& username, string& password,
  */
 void exit_client(int exitcode, bool wait) {   
     if (simulate) {
+        // the simulation summary is built from the results of all finished jobs
+        vector<int> unfinished_job_ids;
+        stop_result_threads(true, unfinished_job_ids);
+        stop_janitor_thread();
         simulate_exit_client();
         return ;
     }
+    // hand back the jobs that were claimed by the prefetch thread but not started before
+    // waiting for the running jobs, they could be processed by other clients meanwhile
+    defer_signals();
+    vector<int> prefetched_job_ids;
+    stop_prefetch_thread(prefetched_job_ids);
+    for (vector<int>::iterator it = prefetched_job_ids.begin(); it != prefetched_job_ids.end(); ++it) {
+        log_message(LOG_DEBUG, "Resetting prefetched job %d to \"not started\"", *it);
+        db_reset_job(*it);
+    }
+    reset_signal_handler();
     if (wait) {
         bool jobs_running;
         do {
@@ -1651,18 +2588,29 @@ void exit_client(int exitcode, bool wait) {
                 jobs_running |= it->used;
             }
             process_messages();
-            usleep(100 * 1000); // 100 ms
+            if (jobs_running) {
+                events_wait(-1);
+            }
         } while (jobs_running);
     }
+    stop_sampler_thread();
+    // write the results of the finished jobs to the DB, if we don't wait for them, reset them
+    vector<int> unfinished_job_ids;
+    stop_result_threads(wait, unfinished_job_ids);
+    stop_janitor_thread();
     stop_message_thread();
     
     // This routine should not be interrupted by further signals, if possible
     defer_signals();
-    // if there's a job for which the client was downloading resources and got interrupted before actually allocating
-    // a worker slot, reset this job in the DB
-    if (downloading_job.idJob != 0) {
-        log_message(LOG_DEBUG, "Client killed while downloading resources for job %d. Resetting job to \"not started\"", downloading_job.idJob);
-        db_reset_job(downloading_job.idJob);
+    // if there's a job that was about to be launched when the client got interrupted before actually
+    // allocating a worker slot, reset this job in the DB
+    if (launching_job.idJob != 0) {
+        log_message(LOG_DEBUG, "Client killed while launching job %d. Resetting job to \"not started\"", launching_job.idJob);
+        db_reset_job(launching_job.idJob);
+    }
+    for (vector<int>::iterator it = unfinished_job_ids.begin(); it != unfinished_job_ids.end(); ++it) {
+        log_message(LOG_DEBUG, "Results of job %d were not processed. Resetting job to \"not started\"", *it);
+        db_reset_job(*it);
     }
     
     // if there's still anything running, too bad!
@@ -1686,6 +2634,9 @@ void exit_client(int exitcode, bool wait) {
     for (vector<Worker>::iterator it = workers.begin(); it != workers.end(); ++it) {
         if (it->used) {
             kill_process(it->pid);
+            if (!it->cgroup.empty()) {
+                cgroup_kill(it->cgroup);
+            }
         }
     }
 
@@ -1699,7 +2650,7 @@ void print_usage() {
     cout << "EDACC Client" << endl;
     cout << "------------" << endl;
     cout << endl;
-    cout << "Usage: ./client [-v <verbosity>] [-l] [-w <wait for jobs time (s)>] [-i <handle workers interval (ms)>] [-k] [-b <path>] [-h] [-s]" << endl;
+    cout << "Usage: ./client [-v <verbosity>] [-l] [-w <wait for jobs time (s)>] [-i <check jobs interval (ms)>] [-k] [-b <path>] [-h] [-s]" << endl;
     // ------------------------------------------------------------------------------------X <-- last char here! (80 chars)
     cout << "Parameters:" << endl;
     cout << "  -v <verbosity>:                  integer value between 0 and 4 (from lowest " << endl <<
@@ -1714,9 +2665,9 @@ void print_usage() {
     cout << "  -w <wait for jobs time (s)>:     how long the client should wait for jobs " << endl <<
             "                                   after it didn't get any new jobs before " << endl <<
             "                                   exiting." << endl;
-    cout << "  -i <handle workers interval ms>: how long the client should wait after" << endl <<
-            "                                   handling workers and before looking for a " << endl <<
-            "                                   new job." << endl;
+    cout << "  -i <check jobs interval ms>:     how long the client should wait before " << endl <<
+            "                                   looking for a new job again if there are " << endl <<
+            "                                   idle workers." << endl;
     cout << "  -k:                              whether to keep the solver and watcher " << endl <<
             "                                   output files after uploading to the DB. " << endl <<
             "                                   Default behaviour is to delete them." << endl;
@@ -1726,12 +2677,62 @@ void print_usage() {
             "                                   instances. Use this option for shared file " << endl <<
             "                                   systems. Defaults to base path." << endl;
     cout << "  -f <path>:                       base path for temporary solver files." << endl;
+    cout << "  -j <number of jobs>:             minimum number of jobs that are fetched and " << endl <<
+            "                                   prepared in advance while all workers are " << endl <<
+            "                                   busy. More jobs are prepared if the jobs are" << endl <<
+            "                                   short. Defaults to 1." << endl;
+    cout << "  -e <lease time (s)>:             prepared jobs that weren't started within " << endl <<
+            "                                   this time are handed back to the DB. 0 " << endl <<
+            "                                   keeps them. Jobs prepared by clients that " << endl <<
+            "                                   didn't report for this time are handed back, " << endl <<
+            "                                   too. Defaults to 600." << endl;
+    cout << "  -u <time (s)>:                   how long the list of experiments and the " << endl <<
+            "                                   number of CPUs working on them is cached. " << endl <<
+            "                                   0 disables the cache. Defaults to 5." << endl;
+    cout << "  -r <number of threads>:          number of threads that process the results of" << endl <<
+            "                                   finished jobs. Defaults to 2." << endl;
+    cout << "  -g <number of jobs>:             claim the jobs of one solver binary in a row " << endl <<
+            "                                   until there are none left or this many jobs " << endl <<
+            "                                   were claimed, then switch the solver binary. " << endl <<
+            "                                   0 disables the grouping. Defaults to 0." << endl;
+    cout << "  -n:                              run the solvers without runsolver. The " << endl <<
+            "                                   client enforces the limits and measures the " << endl <<
+            "                                   times itself, no watcher output file is " << endl <<
+            "                                   written." << endl;
+    cout << "  -a <path>:                       delegated cgroup v2 directory. Each job gets " << endl <<
+            "                                   a cgroup below it that limits the memory " << endl <<
+            "                                   and CPUs of the job, accounts its resource " << endl <<
+            "                                   usage and kills all processes of the job " << endl <<
+            "                                   when it ends." << endl;
+    cout << "  -m <policy>:                     how jobs are placed on the processing units:" << endl <<
+            "                                   spread (default) spreads them over sockets, " << endl <<
+            "                                   caches and cores and uses SMT siblings only " << endl <<
+            "                                   if needed, core runs one job per physical " << endl <<
+            "                                   core and leaves SMT siblings idle, scatter " << endl <<
+            "                                   starts each job in the L3 cache with the " << endl <<
+            "                                   fewest running jobs, compact fills up cores " << endl <<
+            "                                   and caches one after the other." << endl;
+    cout << "  -x:                              count the instructions, cycles, last level " << endl <<
+            "                                   cache misses and context switches of the " << endl <<
+            "                                   jobs with hardware performance counters. " << endl <<
+            "                                   The totals are added to the launcher output " << endl <<
+            "                                   and stored in ExperimentResults if it has " << endl <<
+            "                                   the columns instructions, cycles, llcMisses " << endl <<
+            "                                   and contextSwitches." << endl;
+    cout << "  -o <interval (ms)>:              sample the memory usage, CPU time, major " << endl <<
+            "                                   page faults and I/O of the running jobs at " << endl <<
+            "                                   this interval. Peak values and a trace are " << endl <<
+            "                                   added to the launcher output. 0 disables " << endl <<
+            "                                   sampling. Defaults to 0, 1000 is a good value." << endl;
     cout << "  -h:                              toggles whether the client should continue " << endl <<
             "                                   to run even though the CPU hardware of the " << endl <<
             "                                   grid queue is not homogenous." << endl;
     cout << "  -s:                              simulation mode: don't write anything to the" << endl <<
             "                                   db." << endl;
-    cout << "  -t <walltime>:                   expects walltime in the format [[[d:]h:]m:]s." << endl;
+    cout << "  -t <walltime>:                   expects walltime in the format [[[d:]h:]m:]s." << endl <<
+            "                                   Only jobs whose time limit ends within the " << endl <<
+            "                                   walltime are started. The client exits when " << endl <<
+            "                                   no job fits anymore." << endl;
     cout << endl;
     cout << COMPILATION_TIME << endl;
 }
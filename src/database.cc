@@ -6,6 +6,8 @@
 #include <vector>
 #include <map>
 #include <cmath>
+#include <set>
+#include <algorithm>
 #include <mysql/mysql.h>
 #include <mysql/my_global.h>
 #include <mysql/errmsg.h>
@@ -27,6 +29,7 @@ using std::string;
 using std::vector;
 using std::map;
 using std::stringstream;
+using std::set;
 
 extern string base_path;
 extern string solver_path;
@@ -39,12 +42,23 @@ extern string verifier_path;
 extern string verifier_download_path;
 extern string cost_binary_download_path;
 
-MYSQL* connection = 0;
+// every thread that talks to the database has its own connection, see database_connect_thread()
+__thread MYSQL* connection = 0;
+// whether ExperimentResults has the performance counter columns, see has_result_counters()
+static bool result_counters = false;
+// whether the claimJobs procedure exists, see has_claim_procedure()
+static bool claim_procedure = false;
+
+// connection details, used to establish additional connections
+static string db_hostname, db_database, db_username, db_password;
+static unsigned int db_port;
 
 // from client.cc
 extern time_t opt_wait_jobs_time; // seconds
 
 static time_t WAIT_BETWEEN_RECONNECTS = 5;
+// maximum number of ids in the hint about locally available instances and solver binaries
+static const size_t MAX_HINT_IDS = 1000;
 
 // the file system id. Assigned when client signs on.
 int fsid;
@@ -74,7 +88,7 @@ int database_connect(const string& hostname, const string& database, const strin
     }
 
     if (mysql_real_connect(connection, hostname.c_str(), username.c_str(), password.c_str(), database.c_str(), port,
-            NULL, 0) == NULL) {
+            NULL, CLIENT_MULTI_RESULTS) == NULL) {
         log_error(AT, "Database connection attempt failed: %s", mysql_error(connection));
         return 0;
     }
@@ -88,6 +102,11 @@ int database_connect(const string& hostname, const string& database, const strin
     log_message(LOG_INFO, "Established database connection to %s:%s@%s:%u/%s", username.c_str(), password.c_str(),
             hostname.c_str(), port, database.c_str());
 
+    db_hostname = hostname;
+    db_database = database;
+    db_username = username;
+    db_password = password;
+    db_port = port;
     return 1;
 }
 
@@ -100,11 +119,11 @@ int get_new_connection(MYSQL *&con) {
     if (con != NULL)
         mysql_close(con);
     con = mysql_init(NULL);
-    if (con == NULL || connection == NULL) {
+    if (con == NULL || db_hostname == "") {
         return 0;
     }
-    if (mysql_real_connect(con, connection->host, connection->user, connection->passwd, connection->db,
-            connection->port, NULL, 0) == NULL) {
+    if (mysql_real_connect(con, db_hostname.c_str(), db_username.c_str(), db_password.c_str(), db_database.c_str(),
+            db_port, NULL, CLIENT_MULTI_RESULTS) == NULL) {
         log_error(AT, "Database connection attempt failed: %s", mysql_error(con));
         return 0;
     }
@@ -112,29 +131,52 @@ int get_new_connection(MYSQL *&con) {
     // e.g. due to connection time outs. Failed queries have to be
     // re-issued in any case.
     my_bool mysql_opt_reconnect = 1;
-    mysql_options(connection, MYSQL_OPT_RECONNECT, &mysql_opt_reconnect);
+    mysql_options(con, MYSQL_OPT_RECONNECT, &mysql_opt_reconnect);
 
     return 1;
 }
 
+/**
+ * Establishes the database connection of the calling thread. All database functions
+ * called from this thread afterwards use this connection. Has to be called by every thread
+ * other than the main thread before using the database functions.
+ *
+ * @return 1 on success, 0 on errors
+ */
+int database_connect_thread() {
+    mysql_thread_init();
+    return get_new_connection(connection);
+}
+
+/**
+ * Closes the database connection of the calling thread.
+ */
+void database_close_thread() {
+    if (connection != NULL) {
+        mysql_close(connection);
+        connection = NULL;
+    }
+    mysql_thread_end();
+}
+
 string get_db_host() {
-    return connection->host;
+    return db_hostname;
 }
 
 string get_db_username() {
-    return connection->user;
+    return db_username;
 }
 
 string get_db_password() {
-    return connection->passwd;
+    return db_password;
 }
 
 string get_db() {
-    return connection->db;
+    return db_database;
 }
 
 int get_db_port() {
-    return connection->port;
+    return db_port;
 }
 
 int database_query_select(string query, MYSQL_RES*& res, MYSQL*& con) {
@@ -281,42 +323,55 @@ int get_current_model_version() {
 }
 
 /**
- * Executes the query needed to insert a new row into the Client table
- * and returns the auto-incremented ID of it. Also determines the file system id
- * or assigns the client id as file system id if it is an unknown file system.
- * 
- * @return id > 0 on success, 0 on errors
+ * Parses a walltime in the format [[[d:]h:]m:]s.
+ *
+ * @param walltime the walltime string, may be empty
+ * @return the walltime in seconds, 0 if <code>walltime</code> is empty, -1 on format errors
  */
-int insert_client(const HostInfo& host_info, int grid_queue_id, int jobs_wait_time, string& opt_walltime) {
-    // parse walltime
-    int walltime = 0;
-    if (opt_walltime != "") {
+int parse_walltime(const string& walltime) {
+    int seconds = 0;
+    if (walltime != "") {
         vector<string> tokens;
-        split(opt_walltime, ':', tokens);
+        split(walltime, ':', tokens);
         if (tokens.size() == 0 || tokens.size() > 4) {
-            log_message(LOG_IMPORTANT, "Unknown walltime format: %s. Expected [[[d:]h:]m:]s");
-            return 0;
+            log_message(LOG_IMPORTANT, "Unknown walltime format: %s. Expected [[[d:]h:]m:]s", walltime.c_str());
+            return -1;
         }
         int i = 0;
         vector<string>::reverse_iterator it;
         for (it = tokens.rbegin(); it < tokens.rend(); ++it) {
             switch (i) {
                 case 0:
-                    walltime += atoi((*it).c_str());
+                    seconds += atoi((*it).c_str());
                     break;
                 case 1:
-                    walltime += 60*atoi((*it).c_str());
+                    seconds += 60*atoi((*it).c_str());
                     break;
                 case 2:
-                    walltime += 3600*atoi((*it).c_str());
+                    seconds += 3600*atoi((*it).c_str());
                     break;
                 case 3:
-                    walltime += 86400*atoi((*it).c_str());
+                    seconds += 86400*atoi((*it).c_str());
                     break;
             }
             i++;
         }
     }
+    return seconds;
+}
+
+/**
+ * Executes the query needed to insert a new row into the Client table
+ * and returns the auto-incremented ID of it. Also determines the file system id
+ * or assigns the client id as file system id if it is an unknown file system.
+ * 
+ * @return id > 0 on success, 0 on errors
+ */
+int insert_client(const HostInfo& host_info, int grid_queue_id, int jobs_wait_time, string& opt_walltime) {
+    int walltime = parse_walltime(opt_walltime);
+    if (walltime == -1) {
+        return 0;
+    }
     unsigned int tries = 0;
     bool first_try = true;
     while (first_try || tries++ < max_recover_tries) {
@@ -599,108 +654,107 @@ int decrement_core_count(int client_id, int experiment_id) {
 }
 
 /**
- * Executes the queries needed to fetch, lock and update a job to running status
- * of the given experiment. The job details are stored in <code>job</job>.
- * Also updates the job row to indicate which grid (<code>grid_queue_id</code>)
- * the job runs on.
- * 
+ * Builds the condition for the job queries that restricts the jobs to those
+ * that finish within <code>max_runtime</code> seconds and whose memory limit
+ * is at most <code>max_memory</code> MB.
+ *
+ * @param max_runtime maximum time limit (s) of the jobs, -1 for no restriction
+ * @param max_memory maximum memory limit (MB) of the jobs, -1 for no restriction
+ * @return the condition starting with " AND" or an empty string
+ */
+static string job_condition(int max_runtime, int max_memory) {
+    string condition;
+    char buffer[256];
+    if (max_runtime >= 0) {
+        snprintf(buffer, sizeof(buffer), RUNTIME_CONDITION, max_runtime);
+        condition += buffer;
+    }
+    if (max_memory >= 0) {
+        snprintf(buffer, sizeof(buffer), MEMORY_CONDITION, max_memory);
+        condition += buffer;
+    }
+    return condition;
+}
+
+/**
+ * Reads the columns of a claimed job (see SELECT_FOR_UPDATE) into <code>job</code>.
+ */
+static void read_claimed_job(MYSQL_ROW row, Job& job) {
+    job.idJob = atoi(row[0]);
+    job.idSolverConfig = atoi(row[1]);
+    job.idExperiment = atoi(row[2]);
+    job.idInstance = atoi(row[3]);
+    job.run = atoi(row[4]);
+    if (row[5] != NULL)
+        job.seed = atoi(row[5]); // TODO: not NN column
+    job.priority = atoi(row[6]);
+    if (row[7] != NULL)
+        job.CPUTimeLimit = atoi(row[7]);
+    if (row[8] != NULL)
+        job.wallClockTimeLimit = atoi(row[8]);
+    if (row[9] != NULL)
+        job.memoryLimit = atoi(row[9]);
+    if (row[10] != NULL)
+        job.stackSizeLimit = atoi(row[10]);
+}
+
+/**
+ * Locks the given jobs and updates them to running status in one transaction.
+ * Jobs that were taken by other clients meanwhile, whose time limit exceeds
+ * <code>max_runtime</code> or whose memory limit exceeds <code>max_memory</code> are skipped.
+ *
  * @param client_id ID of the client
  * @param grid_queue_id ID of the grid the client runs on
- * @param experiment_id ID of the experiment of which a job should be processed
- * @param job reference to a job instance that will be filled with the job row data
- * @return id of the job > 0 on success, <= 0 on errors or if there are no jobs
+ * @param job_ids the ids of the jobs
+ * @param max_runtime maximum time limit (s) of the jobs, -1 for no restriction
+ * @param max_memory maximum memory limit (MB) of the jobs, -1 for no restriction
+ * @param jobs vector the locked jobs are appended to
+ * @return number of locked jobs, 0 on errors
  */
-int db_fetch_job(int client_id, int grid_queue_id, int experiment_id, int solver_binary_id, Job& job) {
-    int idJob = -1;
-    char* query = new char[1024];
-    MYSQL_RES* result;
-    MYSQL_ROW row;
-    if (jobserver != NULL) {
-        if (!jobserver->getJobId(experiment_id, solver_binary_id, idJob)) {
-            delete[] query;
-            return -1;
-        }
-    } else {
-        snprintf(query, 1024, LIMIT_QUERY, experiment_id);
-        if (database_query_select(query, result) == 0) {
-            log_error(AT, "Couldn't execute LIMIT_QUERY query");
-            // TODO: do something
-            delete[] query;
-            return -1;
-        }
-        if (mysql_num_rows(result) < 1) {
-            mysql_free_result(result);
-            delete[] query;
-            return -1;
-        }
-        row = mysql_fetch_row(result);
-        int limit = atoi(row[0]);
-        mysql_free_result(result);
-
-        if (solver_binary_id != -1) {
-            snprintf(query, 1024, SELECT_ID_QUERY_SB, experiment_id, solver_binary_id, limit);
-        } else {
-            snprintf(query, 1024, SELECT_ID_QUERY, experiment_id, limit);
-        }
-        if (database_query_select(query, result) == 0) {
-            log_error(AT, "Couldn't execute SELECT_ID_QUERY query");
-            // TODO: do something
-            delete[] query;
-            return -1;
-        }
-        if (mysql_num_rows(result) < 1) {
-            mysql_free_result(result);
-            delete[] query;
-            return -1;
-        }
-        row = mysql_fetch_row(result);
-        idJob = atoi(row[0]);
-        mysql_free_result(result);
+static int lock_jobs(int client_id, int grid_queue_id, const vector<int>& job_ids, int max_runtime, int max_memory,
+                     vector<Job>& jobs) {
+    if (job_ids.empty()) {
+        return 0;
     }
 
-    if (idJob == -1) {
-        delete[] query;
-        mysql_autocommit(connection, 1);
-        return -1;
+    MYSQL_RES* result;
+    MYSQL_ROW row;
+    stringstream id_list;
+    for (vector<int>::const_iterator it = job_ids.begin(); it != job_ids.end(); ++it) {
+        if (it != job_ids.begin()) id_list << ",";
+        id_list << *it;
     }
+    size_t query_length = 1024 + id_list.str().length();
+    char* query = new char[query_length];
     
     mysql_autocommit(connection, 0);
-    snprintf(query, 1024, SELECT_FOR_UPDATE, idJob);
+    snprintf(query, query_length, SELECT_FOR_UPDATE, id_list.str().c_str(), job_condition(max_runtime, max_memory).c_str());
     if (database_query_select(query, result) == 0) {
         log_error(AT, "Couldn't execute SELECT_FOR_UPDATE query");
         // TODO: do something
         delete[] query;
-        mysql_free_result(result);
         mysql_rollback(connection);
         mysql_autocommit(connection, 1);
-        return -1;
+        return 0;
     }
     if (mysql_num_rows(result) < 1) {
         mysql_free_result(result);
         delete[] query;
         mysql_rollback(connection);
         mysql_autocommit(connection, 1);
-        return -1; // job was taken by another client between the 2 queries
+        return 0; // jobs were taken by other clients between the 2 queries
     }
-    row = mysql_fetch_row(result);
-
-    job.idJob = atoi(row[0]);
-    job.idSolverConfig = atoi(row[1]);
-    job.idExperiment = atoi(row[2]);
-    job.idInstance = atoi(row[3]);
-    job.run = atoi(row[4]);
-    if (row[5] != NULL)
-        job.seed = atoi(row[5]); // TODO: not NN column
-    job.priority = atoi(row[6]);
-    if (row[7] != NULL)
-        job.CPUTimeLimit = atoi(row[7]);
-    if (row[8] != NULL)
-        job.wallClockTimeLimit = atoi(row[8]);
-    if (row[9] != NULL)
-        job.memoryLimit = atoi(row[9]);
-    if (row[10] != NULL)
-        job.stackSizeLimit = atoi(row[10]);
 
+    // only the rows that are still unprocessed were locked
+    vector<Job> locked_jobs;
+    stringstream locked_id_list;
+    while ((row = mysql_fetch_row(result))) {
+        Job job;
+        read_claimed_job(row, job);
+        if (!locked_jobs.empty()) locked_id_list << ",";
+        locked_id_list << job.idJob;
+        locked_jobs.push_back(job);
+    }
     mysql_free_result(result);
 
     string ipaddress = get_ip_address(false);
@@ -708,20 +762,362 @@ int db_fetch_job(int client_id, int grid_queue_id, int experiment_id, int solver
         ipaddress = get_ip_address(true);
     string hostname = get_hostname();
 
-    snprintf(query, 1024, LOCK_JOB, grid_queue_id, hostname.c_str(), ipaddress.c_str(), client_id, idJob);
+    snprintf(query, query_length, LOCK_JOB, grid_queue_id, hostname.c_str(), ipaddress.c_str(), client_id,
+             locked_id_list.str().c_str());
     if (database_query_update(query) == 0) {
         log_error(AT, "Couldn't execute LOCK_JOB query");
         // TODO: do something
         delete[] query;
         mysql_rollback(connection);
         mysql_autocommit(connection, 1);
-        return -1;
+        return 0;
     }
     delete[] query;
     mysql_commit(connection);
     mysql_autocommit(connection, 1);
-    ;
-    return idJob;
+    jobs.insert(jobs.end(), locked_jobs.begin(), locked_jobs.end());
+    return locked_jobs.size();
+}
+
+/**
+ * Returns a comma separated list of at most <code>MAX_HINT_IDS</code> of the given ids
+ * or NULL if there are no ids.
+ */
+static string hint_id_list(const set<int>& ids) {
+    if (ids.empty()) {
+        return "NULL";
+    }
+    stringstream id_list;
+    size_t num_ids = 0;
+    for (set<int>::const_iterator it = ids.begin(); it != ids.end() && num_ids < MAX_HINT_IDS; ++it, ++num_ids) {
+        if (it != ids.begin()) id_list << ",";
+        id_list << *it;
+    }
+    return id_list.str();
+}
+
+/**
+ * Looks up the solver configs of solver binaries.
+ *
+ * @param solver_binary_ids the comma separated ids of the solver binaries
+ * @param solver_config_ids the comma separated ids of the solver configs, empty if there are none
+ * @return 1 on success, 0 on errors
+ */
+static int get_solver_config_ids(const string& solver_binary_ids, string& solver_config_ids) {
+    size_t query_length = 1024 + solver_binary_ids.length();
+    char* query = new char[query_length];
+    snprintf(query, query_length, QUERY_SOLVER_CONFIG_IDS, solver_binary_ids.c_str());
+    MYSQL_RES* result;
+    if (database_query_select(query, result) == 0) {
+        log_error(AT, "Couldn't execute QUERY_SOLVER_CONFIG_IDS query");
+        delete[] query;
+        return 0;
+    }
+    delete[] query;
+    stringstream id_list;
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result))) {
+        if (!id_list.str().empty()) id_list << ",";
+        id_list << row[0];
+    }
+    mysql_free_result(result);
+    solver_config_ids = id_list.str();
+    return 1;
+}
+
+/**
+ * Selects the ids of up to <code>num_jobs</code> unprocessed jobs of the experiment with the given
+ * priority whose instance or solver binary is available locally, so that nothing has to be downloaded.
+ *
+ * @param experiment_id ID of the experiment
+ * @param solver_binary_id ID of the solver binary the jobs should use, -1 for any
+ * @param priority priority of the jobs
+ * @param num_jobs maximum number of jobs
+ * @param condition the conditions of the jobs, see db_fetch_jobs()
+ * @param local_resources the locally available instances and solver binaries
+ * @param job_ids vector the ids of the jobs are appended to
+ */
+static void fetch_cached_job_ids(int experiment_id, int solver_binary_id, int priority, int num_jobs,
+                                 const string& condition, const LocalResources& local_resources,
+                                 vector<int>& job_ids) {
+    if (local_resources.instance_ids.empty() && (solver_binary_id != -1 || local_resources.solver_binary_ids.empty())) {
+        return;
+    }
+    string instance_ids = hint_id_list(local_resources.instance_ids);
+    string solver_binary_ids = hint_id_list(local_resources.solver_binary_ids);
+    size_t query_length = 1024 + condition.length() + 2 * instance_ids.length() + 2 * solver_binary_ids.length();
+    char* query = new char[query_length];
+    if (solver_binary_id != -1) {
+        snprintf(query, query_length, SELECT_ID_QUERY_CACHED_SB, experiment_id, priority,
+                 condition.c_str(), instance_ids.c_str(), num_jobs);
+    } else {
+        snprintf(query, query_length, SELECT_ID_QUERY_CACHED, experiment_id, priority,
+                 condition.c_str(), instance_ids.c_str(),
+                 solver_binary_ids.c_str(), instance_ids.c_str(), solver_binary_ids.c_str(), num_jobs);
+    }
+    MYSQL_RES* result;
+    if (database_query_select(query, result) == 0) {
+        log_error(AT, "Couldn't execute SELECT_ID_QUERY_CACHED query");
+        delete[] query;
+        return;
+    }
+    delete[] query;
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result))) {
+        job_ids.push_back(atoi(row[0]));
+    }
+    mysql_free_result(result);
+    log_message(LOG_DEBUG, "Found %d jobs using locally available instances or solver binaries", job_ids.size());
+}
+
+/**
+ * Looks up the ids of the instances and solver binaries in the instance and solver directories.
+ * Their directory names are the md5 sums.
+ *
+ * @param local_resources the ids are added to this
+ * @return 1 on success, 0 on errors
+ */
+int get_local_resources(LocalResources& local_resources) {
+    const string paths[2] = {instance_path, solver_path};
+    const char* queries[2] = {QUERY_INSTANCE_IDS_BY_MD5, QUERY_SOLVER_BINARY_IDS_BY_MD5};
+    set<int>* ids[2] = {&local_resources.instance_ids, &local_resources.solver_binary_ids};
+    for (int i = 0; i < 2; i++) {
+        vector<string> names;
+        list_directories(paths[i], names);
+        stringstream md5_list;
+        size_t num_md5 = 0;
+        for (vector<string>::iterator it = names.begin(); it != names.end() && num_md5 < MAX_HINT_IDS; ++it) {
+            // only md5 sums, this also keeps the list safe to use in the query
+            if (it->length() != 32 || it->find_first_not_of("0123456789abcdef") != string::npos) continue;
+            if (num_md5++ > 0) md5_list << ",";
+            md5_list << "'" << *it << "'";
+        }
+        if (num_md5 == 0) continue;
+        size_t query_length = 1024 + md5_list.str().length();
+        char* query = new char[query_length];
+        snprintf(query, query_length, queries[i], md5_list.str().c_str());
+        MYSQL_RES* result;
+        if (database_query_select(query, result) == 0) {
+            log_error(AT, "Couldn't query the ids of the local instances and solver binaries");
+            delete[] query;
+            return 0;
+        }
+        delete[] query;
+        MYSQL_ROW row;
+        while ((row = mysql_fetch_row(result))) {
+            ids[i]->insert(atoi(row[0]));
+        }
+        mysql_free_result(result);
+    }
+    log_message(LOG_DEBUG, "%d instances and %d solver binaries are available locally",
+                local_resources.instance_ids.size(), local_resources.solver_binary_ids.size());
+    return 1;
+}
+
+/**
+ * Claims up to <code>num_jobs</code> jobs of the experiment with the claimJobs procedure,
+ * which needs a single round trip. The procedure returns each claimed job as a result set.
+ * The solver configs of the solver binaries are looked up before, so that the procedure
+ * only compares ids of ExperimentResults.
+ *
+ * @return number of claimed jobs, -1 if the procedure couldn't be called
+ */
+static int call_claim_jobs(int client_id, int grid_queue_id, int experiment_id, int solver_binary_id, int num_jobs,
+                           int max_runtime, int max_memory, const LocalResources& local_resources, vector<Job>& jobs) {
+    string solver_config_ids;
+    string cached_solver_config_ids;
+    if (solver_binary_id != -1) {
+        ostringstream id;
+        id << solver_binary_id;
+        if (!get_solver_config_ids(id.str(), solver_config_ids)) {
+            return 0;
+        }
+        if (solver_config_ids.empty()) {
+            return 0;
+        }
+    } else if (!local_resources.solver_binary_ids.empty()
+            && !get_solver_config_ids(hint_id_list(local_resources.solver_binary_ids), cached_solver_config_ids)) {
+        return 0;
+    }
+    string instance_ids = local_resources.instance_ids.empty() ? "" : hint_id_list(local_resources.instance_ids);
+    string ipaddress = get_ip_address(false);
+    if (ipaddress == "")
+        ipaddress = get_ip_address(true);
+    string hostname = get_hostname();
+
+    size_t query_length = 1024 + hostname.length() + solver_config_ids.length() + instance_ids.length()
+                          + cached_solver_config_ids.length();
+    char* query = new char[query_length];
+    snprintf(query, query_length, CALL_CLAIM_JOBS, client_id, grid_queue_id, experiment_id, solver_config_ids.c_str(),
+             num_jobs, max_runtime, max_memory, hostname.c_str(), ipaddress.c_str(), instance_ids.c_str(),
+             cached_solver_config_ids.c_str());
+    if (mysql_query(connection, query) != 0) {
+        log_error(AT, "Couldn't execute CALL_CLAIM_JOBS query: %s", mysql_error(connection));
+        delete[] query;
+        // jobs locked by other clients aren't a reason to stop using the procedure
+        return is_recoverable_error() ? 0 : -1;
+    }
+    delete[] query;
+
+    int num_claimed = 0;
+    int status;
+    do {
+        MYSQL_RES* result = mysql_store_result(connection);
+        if (result != NULL) {
+            MYSQL_ROW row;
+            while ((row = mysql_fetch_row(result))) {
+                Job job;
+                read_claimed_job(row, job);
+                jobs.push_back(job);
+                num_claimed++;
+            }
+            mysql_free_result(result);
+        }
+    } while ((status = mysql_next_result(connection)) == 0);
+    if (status > 0) {
+        // the jobs claimed before the error are returned, the failed statement didn't claim a job
+        log_error(AT, "Error while claiming jobs with claimJobs: %s", mysql_error(connection));
+    }
+    return num_claimed;
+}
+
+/**
+ * Executes the queries needed to fetch, lock and update up to <code>num_jobs</code> jobs
+ * of the given experiment to running status. All jobs are claimed in one transaction
+ * which needs the same number of queries as claiming a single job. If the database has
+ * the claimJobs procedure, it is used instead, which needs only one query.
+ * Also updates the job rows to indicate which grid (<code>grid_queue_id</code>)
+ * the jobs run on.
+ * 
+ * @param client_id ID of the client
+ * @param grid_queue_id ID of the grid the client runs on
+ * @param experiment_id ID of the experiment of which jobs should be processed
+ * @param solver_binary_id ID of the solver binary the jobs should use, -1 for any
+ * @param num_jobs maximum number of jobs to claim
+ * @param max_runtime maximum time limit (s) of the jobs, -1 for no restriction
+ * @param max_memory maximum memory limit (MB) of the jobs, -1 for no restriction
+ * @param local_resources jobs using these instances and solver binaries are preferred
+ * @param jobs vector the claimed jobs are appended to
+ * @return number of claimed jobs, 0 on errors or if there are no jobs
+ */
+int db_fetch_jobs(int client_id, int grid_queue_id, int experiment_id, int solver_binary_id, int num_jobs,
+                  int max_runtime, int max_memory, const LocalResources& local_resources, vector<Job>& jobs) {
+    vector<int> job_ids;
+    MYSQL_RES* result;
+    MYSQL_ROW row;
+    if (jobserver != NULL) {
+        int idJob;
+        while ((int)job_ids.size() < num_jobs && jobserver->getJobId(experiment_id, solver_binary_id, idJob) && idJob != -1) {
+            job_ids.push_back(idJob);
+        }
+    } else {
+        if (claim_procedure) {
+            int num_claimed = call_claim_jobs(client_id, grid_queue_id, experiment_id, solver_binary_id, num_jobs,
+                                              max_runtime, max_memory, local_resources, jobs);
+            if (num_claimed >= 0) {
+                return num_claimed;
+            }
+            log_message(LOG_IMPORTANT, "WARNING: Claiming jobs with claimJobs failed, using single queries from now on.");
+            claim_procedure = false;
+        }
+
+        // the conditions are only checked by the queries that select the ids, the priority
+        // levels are read from the index alone
+        string condition = job_condition(max_runtime, max_memory);
+        if (solver_binary_id != -1) {
+            ostringstream id;
+            id << solver_binary_id;
+            string solver_config_ids;
+            if (!get_solver_config_ids(id.str(), solver_config_ids) || solver_config_ids.empty()) {
+                return 0;
+            }
+            condition += " AND SolverConfig_idSolverConfig IN (" + solver_config_ids + ")";
+        }
+        size_t query_length = 2048 + 2 * condition.length();
+        char* query = new char[query_length];
+        snprintf(query, query_length, PRIORITY_LEVELS_QUERY, experiment_id);
+        MYSQL_RES* levels;
+        if (database_query_select(query, levels) == 0) {
+            log_error(AT, "Couldn't execute PRIORITY_LEVELS_QUERY query");
+            // TODO: do something
+            delete[] query;
+            return 0;
+        }
+        // take the jobs in priority order. Within a level the scan starts at a random id, so
+        // that clients claiming at the same time rarely compete for the same rows.
+        while ((int)job_ids.size() < num_jobs && (row = mysql_fetch_row(levels))) {
+            int priority = atoi(row[0]);
+            int start_id = atoi(row[1]);
+            size_t num_cached_jobs = 0;
+            if (job_ids.empty()) {
+                // first try to get jobs that don't need any downloads
+                fetch_cached_job_ids(experiment_id, solver_binary_id, priority, num_jobs, condition,
+                                     local_resources, job_ids);
+                if ((int)job_ids.size() >= num_jobs) break;
+                num_cached_jobs = job_ids.size();
+            }
+            int limit = num_jobs - job_ids.size();
+            snprintf(query, query_length, SELECT_ID_QUERY, experiment_id, priority, condition.c_str(), start_id, limit,
+                     experiment_id, priority, condition.c_str(), start_id, limit, limit + (int)num_cached_jobs);
+            if (database_query_select(query, result) == 0) {
+                log_error(AT, "Couldn't execute SELECT_ID_QUERY query");
+                // TODO: do something
+                break;
+            }
+            while ((row = mysql_fetch_row(result)) && (int)job_ids.size() < num_jobs) {
+                int idJob = atoi(row[0]);
+                if (find(job_ids.begin(), job_ids.begin() + num_cached_jobs, idJob) == job_ids.begin() + num_cached_jobs) {
+                    job_ids.push_back(idJob);
+                }
+            }
+            mysql_free_result(result);
+        }
+        mysql_free_result(levels);
+        delete[] query;
+    }
+
+    return lock_jobs(client_id, grid_queue_id, job_ids, max_runtime, max_memory, jobs);
+}
+
+/**
+ * Blocks until the job server has a job of one of the grid queue's experiments or
+ * <code>timeout</code> milliseconds passed and claims this job.
+ * This is only available if a job server is used.
+ *
+ * @param client_id ID of the client
+ * @param grid_queue_id ID of the grid the client runs on
+ * @param solver_binary_id ID of the solver binary the job should use, -1 for any
+ * @param timeout maximum time (ms) to wait for a job
+ * @param max_runtime maximum time limit (s) of the job, -1 for no restriction
+ * @param max_memory maximum memory limit (MB) of the job, -1 for no restriction
+ * @param jobs vector the claimed job is appended to
+ * @return number of claimed jobs, 0 on timeout, -1 on errors or if there's no job server
+ */
+int db_wait_for_jobs(int client_id, int grid_queue_id, int solver_binary_id, int timeout, int max_runtime,
+                     int max_memory, vector<Job>& jobs) {
+    if (jobserver == NULL) {
+        return -1;
+    }
+    int experiment_id, idJob;
+    if (!jobserver->waitForJobId(grid_queue_id, solver_binary_id, timeout, experiment_id, idJob)) {
+        return -1;
+    }
+    if (idJob == -1) {
+        return 0;
+    }
+    vector<int> job_ids;
+    job_ids.push_back(idJob);
+    return lock_jobs(client_id, grid_queue_id, job_ids, max_runtime, max_memory, jobs);
+}
+
+/**
+ * Makes a db_wait_for_jobs() call of another thread return at once. Called when the client
+ * exits, waiting for jobs isn't possible afterwards.
+ */
+void db_interrupt_wait_for_jobs() {
+    if (jobserver != NULL) {
+        jobserver->interrupt();
+    }
 }
 
 /**
@@ -1672,6 +2068,168 @@ int get_solver_config_params(int solver_config_id, vector<Parameter>& params) {
     return 1;
 }
 
+/**
+ * Checks whether the SolverConfig table has the optional numCPUs column.
+ *
+ * @return 1 if the column exists, 0 if it doesn't or on errors
+ */
+int has_solver_config_cpus() {
+    MYSQL_RES* result;
+    if (database_query_select(QUERY_HAS_SOLVER_CONFIG_CPUS, result) == 0) {
+        log_error(AT, "Couldn't execute QUERY_HAS_SOLVER_CONFIG_CPUS query");
+        return 0;
+    }
+    int has_column = mysql_num_rows(result) > 0 ? 1 : 0;
+    mysql_free_result(result);
+    return has_column;
+}
+
+/**
+ * Checks whether the ExperimentResults table has the optional performance counter columns
+ * (instructions, cycles, llcMisses, contextSwitches). If it has, db_update_job() stores the
+ * counters of the jobs in them.
+ *
+ * @return 1 if the columns exist, 0 if they don't or on errors
+ */
+int has_result_counters() {
+    MYSQL_RES* result;
+    if (database_query_select(QUERY_HAS_RESULT_COUNTERS, result) == 0) {
+        log_error(AT, "Couldn't execute QUERY_HAS_RESULT_COUNTERS query");
+        return 0;
+    }
+    result_counters = mysql_num_rows(result) > 0;
+    mysql_free_result(result);
+    return result_counters ? 1 : 0;
+}
+
+/**
+ * Checks whether ExperimentResults has the index of contrib/indexes.sql that claiming jobs
+ * and reclaiming leases rely on.
+ *
+ * @return 1 if the index exists, 0 if it doesn't, -1 on errors
+ */
+int has_claim_index() {
+    MYSQL_RES* result;
+    if (database_query_select(QUERY_HAS_CLAIM_INDEX, result) == 0) {
+        log_error(AT, "Couldn't execute QUERY_HAS_CLAIM_INDEX query");
+        return -1;
+    }
+    int has_index = mysql_num_rows(result) > 0 ? 1 : 0;
+    mysql_free_result(result);
+    return has_index;
+}
+
+/**
+ * Checks whether the database has the optional claimJobs procedure (see contrib/claim_jobs.sql).
+ * If it has, db_fetch_jobs() claims jobs with it.
+ *
+ * @return 1 if the procedure exists, 0 if it doesn't or on errors
+ */
+int has_claim_procedure() {
+    MYSQL_RES* result;
+    if (database_query_select(QUERY_HAS_CLAIM_PROCEDURE, result) == 0) {
+        log_error(AT, "Couldn't execute QUERY_HAS_CLAIM_PROCEDURE query");
+        return 0;
+    }
+    claim_procedure = mysql_num_rows(result) > 0;
+    mysql_free_result(result);
+    return claim_procedure ? 1 : 0;
+}
+
+static string counter_value(long long value) {
+    if (value < 0) {
+        return "NULL";
+    }
+    ostringstream oss;
+    oss << value;
+    return oss.str();
+}
+
+/**
+ * Stores the performance counters of the job in the optional columns of ExperimentResults.
+ *
+ * @param job the job
+ * @return 1 on success, 0 on errors
+ */
+static int db_update_job_counters(const Job& job) {
+    char* query = new char[1024];
+    snprintf(query, 1024, QUERY_UPDATE_JOB_COUNTERS, counter_value(job.instructions).c_str(),
+             counter_value(job.cycles).c_str(), counter_value(job.llcMisses).c_str(),
+             counter_value(job.contextSwitches).c_str(), job.idJob);
+    int res = database_query_update(query);
+    if (res == 0) {
+        log_error(AT, "Couldn't store the performance counters of job %d", job.idJob);
+    }
+    delete[] query;
+    return res;
+}
+
+/**
+ * Retrieves the number of CPUs the solver configuration specified by <code>solver_config_id</code>
+ * needs. Only valid if has_solver_config_cpus() returned 1.
+ *
+ * @param solver_config_id ID of the solver configuration
+ * @param num_cpus reference where the number of CPUs is put in, 0 if it isn't specified
+ * @return 1 on success, 0 on errors
+ */
+int get_solver_config_cpus(int solver_config_id, int& num_cpus) {
+    char* query = new char[1024];
+    snprintf(query, 1024, QUERY_SOLVER_CONFIG_CPUS, solver_config_id);
+    MYSQL_RES* result;
+    if (database_query_select(query, result) == 0) {
+        log_error(AT, "Couldn't execute QUERY_SOLVER_CONFIG_CPUS query");
+        delete[] query;
+        return 0;
+    }
+    delete[] query;
+    MYSQL_ROW row = mysql_fetch_row(result);
+    num_cpus = 0;
+    if (row != NULL && row[0] != NULL) {
+        num_cpus = atoi(row[0]);
+    }
+    mysql_free_result(result);
+    return 1;
+}
+
+/**
+ * Retrieves the average run time of the finished runs of the solver configuration on the instance
+ * in the experiment. If there are none, the runs of the other solver configurations of the solver binary
+ * on the instance in the experiment are used.
+ *
+ * @param experiment_id ID of the experiment
+ * @param solver_config_id ID of the solver configuration
+ * @param solver_binary_id ID of the solver binary of the solver configuration
+ * @param instance_id ID of the instance
+ * @param runtime reference where the average run time (s) is put in
+ * @param count reference where the number of runs is put in, 0 if there are none
+ * @return 1 on success, 0 on errors
+ */
+int get_runtime_history(int experiment_id, int solver_config_id, int solver_binary_id, int instance_id, double& runtime, int& count) {
+    char* query = new char[1024];
+    count = 0;
+    for (int i = 0; i < 2 && count == 0; i++) {
+        if (i == 0) {
+            snprintf(query, 1024, QUERY_RUNTIME_HISTORY, experiment_id, instance_id, solver_config_id);
+        } else {
+            snprintf(query, 1024, QUERY_RUNTIME_HISTORY_SB, experiment_id, instance_id, solver_binary_id);
+        }
+        MYSQL_RES* result;
+        if (database_query_select(query, result) == 0) {
+            log_error(AT, "Couldn't execute QUERY_RUNTIME_HISTORY query");
+            delete[] query;
+            return 0;
+        }
+        MYSQL_ROW row = mysql_fetch_row(result);
+        if (row != NULL && row[0] != NULL && row[1] != NULL) {
+            runtime = atof(row[0]);
+            count = atoi(row[1]);
+        }
+        mysql_free_result(result);
+    }
+    delete[] query;
+    return 1;
+}
+
 /**
  * Resets a job that was set to running but not actually started
  * back to 'not running'.
@@ -1696,6 +2254,87 @@ int db_reset_job(int job_id) {
     return 0;
 }
 
+/**
+ * Sets the start time of a job that was just started to the current time. Jobs are claimed
+ * without start time, this ends their lease (see db_reclaim_leases()).
+ *
+ * @param job_id the id of the job
+ * @return 1 on success, 0 on errors
+ */
+int db_update_start_time(int job_id) {
+    char* query = new char[1024];
+    snprintf(query, 1024, QUERY_UPDATE_START_TIME, job_id);
+
+    unsigned int tries = 0;
+    do {
+        if (database_query_update(query) == 1) {
+            delete[] query;
+            return 1;
+        }
+    } while (is_recoverable_error() && ++tries < max_recover_tries);
+
+    log_error(AT, "Couldn't execute query to update the start time of jobs");
+    delete[] query;
+    return 0;
+}
+
+/**
+ * Hands the jobs of the given experiments back that were claimed but not started by clients
+ * which didn't report for <code>lease_time</code> seconds. Running clients report every few
+ * seconds (see check_message()), so these clients died and their jobs would be lost otherwise.
+ * The expired leases are looked up without locking any rows, only those jobs are updated.
+ *
+ * @param experiment_ids the experiments whose jobs are checked
+ * @param lease_time time (s) after the last report of a client when its leases expire
+ * @return number of jobs that were handed back, -1 on errors
+ */
+int db_reclaim_leases(const set<int>& experiment_ids, int lease_time) {
+    if (experiment_ids.empty()) {
+        return 0;
+    }
+    stringstream experiment_list;
+    for (set<int>::const_iterator it = experiment_ids.begin(); it != experiment_ids.end(); ++it) {
+        if (it != experiment_ids.begin()) experiment_list << ",";
+        experiment_list << *it;
+    }
+    size_t query_length = 1024 + experiment_list.str().length();
+    char* query = new char[query_length];
+    snprintf(query, query_length, QUERY_EXPIRED_LEASES, experiment_list.str().c_str(), lease_time);
+    MYSQL_RES* result;
+    if (database_query_select(query, result) == 0) {
+        log_error(AT, "Couldn't execute QUERY_EXPIRED_LEASES query");
+        delete[] query;
+        return -1;
+    }
+    delete[] query;
+    stringstream id_list;
+    int num_jobs = 0;
+    MYSQL_ROW row;
+    while ((row = mysql_fetch_row(result))) {
+        if (num_jobs++ > 0) id_list << ",";
+        id_list << row[0];
+    }
+    mysql_free_result(result);
+    if (num_jobs == 0) {
+        return 0;
+    }
+
+    query_length = 1024 + id_list.str().length();
+    query = new char[query_length];
+    snprintf(query, query_length, QUERY_RECLAIM_LEASES, id_list.str().c_str(), lease_time);
+    unsigned int tries = 0;
+    do {
+        if (database_query_update(query) == 1) {
+            delete[] query;
+            return (int) mysql_affected_rows(connection);
+        }
+    } while (is_recoverable_error() && ++tries < max_recover_tries);
+
+    log_error(AT, "Couldn't execute query to reclaim expired leases");
+    delete[] query;
+    return -1;
+}
+
 int escape_string_with_limits(MYSQL* con, const char *from, unsigned long max_len, bool limit, int first, int last, char **output) {
     log_message(LOG_DEBUG, "Output limits - first: %d, last %d", first, last);
     // copy output from position 0 (inclusive) to pos_first_end (exclusive)
@@ -1783,6 +2422,9 @@ int escape_string_with_limits(MYSQL* con, const char *from, unsigned long max_le
  * @return 1 on success, 0 on errors
  */
 int db_update_job(const Job& job) {
+    if (result_counters && (job.instructions >= 0 || job.cycles >= 0 || job.llcMisses >= 0 || job.contextSwitches >= 0)) {
+        db_update_job_counters(job);
+    }
     char* escaped_solver_output;
     char* escaped_launcher_output;
     char* escaped_verifier_output;
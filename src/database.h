@@ -24,6 +24,8 @@ extern int database_connect(const string& hostname, const string& database,
 							const string& username, const string& password,
 							unsigned int port);
 int get_new_connection(MYSQL *&con);
+int database_connect_thread();
+void database_close_thread();
 string get_db();
 string get_db_host();
 string get_db_username();
@@ -46,6 +48,7 @@ const char QUERY_INSERT_CLIENT[] =
                          "lastReport, jobs_wait_time, walltime)"
     "VALUES (%i, %i, %i, %i, '%s', %i, '%s', %llu, %llu, '%s', '%s', '%s', %i, NOW(), %i, %i);";
 extern int insert_client(const HostInfo& host_info, int grid_queue_id, int jobs_wait_time, string& opt_walltime);
+extern int parse_walltime(const string& walltime);
 
 const char QUERY_FILL_GRID_QUEUE_INFO[] =
     "UPDATE gridQueue SET numCores=%i, numThreads=%i, hyperthreading=%i,"
@@ -93,26 +96,74 @@ const char QUERY_DECREMENT_CORE_COUNT[] =
     "WHERE Experiment_idExperiment=%i AND Client_idClient=%i;";
 extern int decrement_core_count(int client_id, int experiment_id);
 
-const char LIMIT_QUERY[] =
-    "SELECT FLOOR(RAND()*countUnprocessedJobs) FROM Experiment "
-    "WHERE idExperiment=%d;";
+// the priority levels of the unprocessed jobs, highest first, with a random job id between the
+// smallest and largest id of each level where the id scan starts. This only reads the index
+// (Experiment_idExperiment, status, priority, idJob) of contrib/indexes.sql, so it must not have
+// conditions on other columns. The solver binary, time and memory limits are checked by SELECT_ID_QUERY.
+const char PRIORITY_LEVELS_QUERY[] =
+    "SELECT priority, FLOOR(MIN(idJob)+RAND()*(MAX(idJob)-MIN(idJob)+1)) FROM ExperimentResults "
+    "WHERE Experiment_idExperiment=%d AND status=-1 AND priority >= 0 GROUP BY priority ORDER BY priority DESC;";
+// checks whether ExperimentResults has an index starting with the columns of the one in contrib/indexes.sql
+const char QUERY_HAS_CLAIM_INDEX[] =
+    "SELECT INDEX_NAME FROM information_schema.STATISTICS "
+    "WHERE TABLE_SCHEMA=DATABASE() AND TABLE_NAME='ExperimentResults' GROUP BY INDEX_NAME "
+    "HAVING GROUP_CONCAT(COLUMN_NAME ORDER BY SEQ_IN_INDEX) LIKE 'Experiment_idExperiment,status,priority,idJob%';";
+extern int has_claim_index();
+// the solver configs of solver binaries, the jobs of a solver binary are selected by these ids
+const char QUERY_SOLVER_CONFIG_IDS[] =
+    "SELECT idSolverConfig FROM SolverConfig WHERE SolverBinaries_idSolverBinary IN (%s);";
+// jobs of one priority level starting at the given id, wrapping around to the smallest ids. The index
+// is scanned from the start id until enough jobs fulfil the conditions.
 const char SELECT_ID_QUERY[] = 
-    "SELECT idJob FROM ExperimentResults WHERE Experiment_idExperiment=%d "
-    "AND status=-1 AND priority >= 0 LIMIT %d,1;";
-const char SELECT_ID_QUERY_SB[] =
+    "(SELECT idJob, 0 AS wrapped FROM ExperimentResults WHERE Experiment_idExperiment=%d "
+    "AND status=-1 AND priority=%d%s AND idJob >= %d ORDER BY idJob LIMIT %d) UNION ALL "
+    "(SELECT idJob, 1 AS wrapped FROM ExperimentResults WHERE Experiment_idExperiment=%d "
+    "AND status=-1 AND priority=%d%s AND idJob < %d ORDER BY idJob LIMIT %d) ORDER BY wrapped, idJob LIMIT %d;";
+// jobs of one priority level whose instance or solver binary is available locally, jobs with both first
+const char SELECT_ID_QUERY_CACHED[] =
     "SELECT idJob FROM ExperimentResults AS er JOIN SolverConfig AS sc ON ("
     "er.SolverConfig_idSolverConfig = sc.idSolverConfig) WHERE er.Experiment_idExperiment=%d "
-    "AND sc.idSolverConfig=%d AND status=-1 AND priority >= 0 LIMIT %d,1;";
+    "AND status=-1 AND priority=%d%s AND (er.Instances_idInstance IN (%s) OR sc.SolverBinaries_idSolverBinary IN (%s)) "
+    "ORDER BY er.Instances_idInstance IN (%s) DESC, sc.SolverBinaries_idSolverBinary IN (%s) DESC LIMIT %d;";
+// the same if the solver binary is given, the condition restricts the jobs to its solver configs
+const char SELECT_ID_QUERY_CACHED_SB[] =
+    "SELECT idJob FROM ExperimentResults WHERE Experiment_idExperiment=%d "
+    "AND status=-1 AND priority=%d%s AND Instances_idInstance IN (%s) LIMIT %d;";
 const char SELECT_FOR_UPDATE[] = 
     "SELECT idJob, SolverConfig_idSolverConfig, Experiment_idExperiment, "
     "Instances_idInstance, run, seed, priority, CPUTimeLimit, wallClockTimeLimit, "
     "memoryLimit, stackSizeLimit "
-    "FROM ExperimentResults WHERE idJob = %d and status=-1 FOR UPDATE;";
+    "FROM ExperimentResults WHERE idJob IN (%s) and status=-1%s FOR UPDATE;";
+// restricts the jobs to those that finish within %d seconds. Jobs without time limit
+// might not finish in time.
+const char RUNTIME_CONDITION[] =
+    " AND IF(wallClockTimeLimit > 0, wallClockTimeLimit, CPUTimeLimit) BETWEEN 1 AND %d";
+// restricts the jobs to those with a memory limit of at most %d MB. Jobs without memory limit fit.
+const char MEMORY_CONDITION[] =
+    " AND IFNULL(memoryLimit, 0) <= %d";
+// the start time is set by start_job() when the job is actually started, see db_update_start_time().
+// Until then the job is leased by the client, see QUERY_RECLAIM_LEASES.
 const char LOCK_JOB[] = 
-    "UPDATE ExperimentResults SET status=0, startTime=NOW(), "
+    "UPDATE ExperimentResults SET status=0, startTime=NULL, "
     "computeQueue=%d, computeNode='%s', computeNodeIP='%s', Client_idClient=%d "
-    "WHERE idJob=%d;";
-extern int db_fetch_job(int client_id, int grid_queue_id, int experiment_id, int solver_binary_id, Job& job);
+    "WHERE idJob IN (%s);";
+// optional stored procedure that claims jobs in one round trip, see contrib/claim_jobs.sql
+const char QUERY_HAS_CLAIM_PROCEDURE[] =
+    "SHOW PROCEDURE STATUS WHERE Db=DATABASE() AND Name='claimJobs';";
+const char CALL_CLAIM_JOBS[] =
+    "CALL claimJobs(%d, %d, %d, '%s', %d, %d, %d, '%s', '%s', '%s', '%s');";
+extern int has_claim_procedure();
+extern int db_fetch_jobs(int client_id, int grid_queue_id, int experiment_id, int solver_binary_id, int num_jobs,
+                         int max_runtime, int max_memory, const LocalResources& local_resources, vector<Job>& jobs);
+
+const char QUERY_INSTANCE_IDS_BY_MD5[] =
+    "SELECT idInstance FROM Instances WHERE md5 IN (%s);";
+const char QUERY_SOLVER_BINARY_IDS_BY_MD5[] =
+    "SELECT idSolverBinary FROM SolverBinaries WHERE md5 IN (%s);";
+extern int get_local_resources(LocalResources& local_resources);
+extern int db_wait_for_jobs(int client_id, int grid_queue_id, int solver_binary_id, int timeout, int max_runtime,
+                            int max_memory, vector<Job>& jobs);
+extern void db_interrupt_wait_for_jobs();
 
 const char QUERY_GRID_QUEUE_INFO[] =
     "SELECT name, location, numCPUs, numCPUsPerJob, description, numCores, CPUName "
@@ -198,6 +249,25 @@ const char QUERY_SOLVER_CONFIG_PARAMS[] =
 
 extern int get_solver_config_params(int solver_config_id, vector<Parameter>& params);
 
+// number of CPUs a solver configuration needs, optional column
+const char QUERY_HAS_SOLVER_CONFIG_CPUS[] =
+    "SHOW COLUMNS FROM SolverConfig LIKE 'numCPUs';";
+const char QUERY_SOLVER_CONFIG_CPUS[] =
+    "SELECT numCPUs FROM SolverConfig WHERE idSolverConfig=%d;";
+extern int has_solver_config_cpus();
+
+// average run time of the finished runs of a solver config or solver binary on an instance in an experiment,
+// both read the runs from idx_history in contrib/indexes.sql
+const char QUERY_RUNTIME_HISTORY[] =
+    "SELECT AVG(resultTime), COUNT(*) FROM ExperimentResults WHERE Experiment_idExperiment=%d "
+    "AND Instances_idInstance=%d AND SolverConfig_idSolverConfig=%d AND status>=1;";
+const char QUERY_RUNTIME_HISTORY_SB[] =
+    "SELECT AVG(er.resultTime), COUNT(*) FROM ExperimentResults AS er JOIN SolverConfig AS sc ON ("
+    "er.SolverConfig_idSolverConfig = sc.idSolverConfig) WHERE er.Experiment_idExperiment=%d "
+    "AND er.Instances_idInstance=%d AND er.status>=1 AND sc.SolverBinaries_idSolverBinary=%d;";
+extern int get_runtime_history(int experiment_id, int solver_config_id, int solver_binary_id, int instance_id, double& runtime, int& count);
+extern int get_solver_config_cpus(int solver_config_id, int& num_cpus);
+
 const char QUERY_VERIFIER[] =
 	"SELECT idVerifier, idVerifierConfig, name, md5, runCommand, runPath "
 	"FROM VerifierConfig JOIN Verifier ON VerifierConfig.Verifier_idVerifier = Verifier.idVerifier "
@@ -226,6 +296,14 @@ const char QUERY_UPDATE_JOB[] =
     "solverExitCode=%d, watcherExitCode=%d, verifierExitCode=%d, cost='%s' "
     "WHERE idJob=%d AND ExperimentResults_idJob=%d;";
 extern int db_update_job(const Job& job);
+
+// performance counter totals of a job, optional columns
+const char QUERY_HAS_RESULT_COUNTERS[] =
+    "SHOW COLUMNS FROM ExperimentResults LIKE 'instructions';";
+const char QUERY_UPDATE_JOB_COUNTERS[] =
+    "UPDATE ExperimentResults SET instructions=%s, cycles=%s, llcMisses=%s, contextSwitches=%s "
+    "WHERE idJob=%d;";
+extern int has_result_counters();
     
 const char QUERY_RESET_JOB[] = 
     "UPDATE ExperimentResults "
@@ -234,6 +312,24 @@ const char QUERY_RESET_JOB[] =
     "WHERE idJob=%d";
 extern int db_reset_job(int job_id);
 
+const char QUERY_UPDATE_START_TIME[] =
+    "UPDATE ExperimentResults SET startTime=NOW() WHERE idJob=%d AND status=0";
+extern int db_update_start_time(int job_id);
+
+// jobs of the given experiments that were claimed but not started by a client that didn't report
+// for %d seconds, i.e. that died or lost its connection. Only the running and leased jobs of the
+// experiments are read, with the index (Experiment_idExperiment, status, ...), see contrib/indexes.sql.
+// The jobs are looked up without locks first, most of the time there are none.
+const char QUERY_EXPIRED_LEASES[] =
+    "SELECT idJob FROM ExperimentResults WHERE Experiment_idExperiment IN (%s) AND status=0 "
+    "AND startTime IS NULL AND NOT EXISTS (SELECT idClient FROM Client "
+    "WHERE idClient=Client_idClient AND lastReport > NOW() - INTERVAL %d SECOND);";
+const char QUERY_RECLAIM_LEASES[] =
+    "UPDATE ExperimentResults SET status=-1, computeQueue=NULL, computeNode=NULL, Client_idClient=NULL "
+    "WHERE idJob IN (%s) AND status=0 AND startTime IS NULL AND NOT EXISTS (SELECT idClient FROM Client "
+    "WHERE idClient=Client_idClient AND lastReport > NOW() - INTERVAL %d SECOND);";
+extern int db_reclaim_leases(const set<int>& experiment_ids, int lease_time);
+
 const char LOCK_MESSAGE[] =
     "SELECT message FROM Client WHERE idClient = %d FOR UPDATE;";
 const char CLEAR_MESSAGE[] =
@@ -15,7 +15,7 @@
 
 // the fsid, from database.cc
 extern int fsid;
-extern MYSQL* connection;
+extern __thread MYSQL* connection;
 
 /**
  * Tries to update the file lock.<br/>
@@ -5,6 +5,7 @@
 #include <set>
 #include <vector>
 #include <cmath>
+#include <ctime>
 using std::string;
 using std::set;
 using std::vector;
@@ -34,6 +35,7 @@ public:
 	int wallClockTimeLimit;
 	int memoryLimit;
 	int stackSizeLimit;
+	int numCPUs; // number of CPUs the job runs on, determined before start
 	
 	int Cost_idCost; // copied from the job's experiment before start
 	int Solver_idSolver; // copied from the job's solver before start
@@ -58,18 +60,22 @@ public:
     bool limit_solver_output, limit_watcher_output, limit_verifier_output;
 
     double cost;
+    bool oom_killed; // whether processes of the job were killed because of the memory limit of its cgroup
+    // performance counter totals of the job's processes, -1 if not measured
+    long long instructions, cycles, llcMisses, contextSwitches;
 
     Job() : idJob(0), idSolverConfig(0), idExperiment(0), idInstance(0), idSolverBinary(0),
             run(0), seed(0), status(0), startTime(""), resultTime(0.0), wallTime(0.0), resultCode(0),
             computeQueue(0), priority(0), computeNode(""), computeNodeIP(""),
-            CPUTimeLimit(0), wallClockTimeLimit(0), memoryLimit(0), stackSizeLimit(0),
+            CPUTimeLimit(0), wallClockTimeLimit(0), memoryLimit(0), stackSizeLimit(0), numCPUs(1),
             Cost_idCost(0), Solver_idSolver(0),
             watcherOutput(""), launcherOutput(""), solverExitCode(0), watcherExitCode(0),
             verifierExitCode(0), solverOutput(0), solverOutput_length(0), 
             verifierOutput(0), verifierOutput_length(0), solver_output_preserve_first(0),
             solver_output_preserve_last(0), watcher_output_preserve_first(0), watcher_output_preserve_last(0),
             verifier_output_preserve_first(0), verifier_output_preserve_last(0), limit_solver_output(false),
-            limit_watcher_output(false), limit_verifier_output(false), cost(NAN) {}
+            limit_watcher_output(false), limit_verifier_output(false), cost(NAN), oom_killed(false),
+            instructions(-1), cycles(-1), llcMisses(-1), contextSwitches(-1) {}
     
 };
 
@@ -145,17 +151,27 @@ public:
 class Worker {
 public:
     int pid;
-#ifdef use_hwloc
+    // PUs the current job is pinned to, empty if it isn't pinned
     set<int> core_ids;
-#endif
+    // NUMA nodes of these PUs the memory of the job is bound to, empty if it isn't bound
+    set<int> numa_nodes;
     bool used;
     Job current_job;
+    // monotonic time (s) when the current job was started
+    double start_time;
+    // built-in watcher: status of the limit the job exceeded (0 if none) and monotonic
+    // time (s) when it was sent SIGTERM because of it (0 if it wasn't)
+    int exceeded_limit;
+    double kill_time;
+    // built-in watcher: CPU time (s) of the process group of the job when it was last checked
+    double cpu_time;
+    // cgroup v2 the current job runs in, empty if it doesn't run in a cgroup
+    string cgroup;
+    // file descriptors of the performance counters of the current job, empty if they aren't used
+    vector<int> perf_counter_fds;
     
-    Worker() : pid(0),
-#ifdef use_hwloc
-            core_ids(),
-#endif
-        used(false) {
+    Worker() : pid(0), core_ids(), numa_nodes(),
+        used(false), start_time(0), exceeded_limit(0), kill_time(0), cpu_time(0), cgroup(), perf_counter_fds() {
     }
 };
 
@@ -223,14 +239,39 @@ public:
 	string md5;
 };
 
+// a claimed job with its resources (solver, instance, parameters) already downloaded
+// and ready to be launched by a worker
+class PreparedJob {
+public:
+    Job job;
+    Solver solver;
+    Instance instance;
+    string instance_binary;
+    string solver_base_path;
+    vector<Parameter> parameters;
+    // when the job was claimed, the claim expires after the lease time if the job isn't started
+    time_t claim_time;
+    // expected run time (s) of the job, -1 if unknown
+    double predicted_runtime;
+};
+
+// ids of the instances and solver binaries that are available on the local disk
+class LocalResources {
+public:
+    set<int> instance_ids;
+    set<int> solver_binary_ids;
+};
+
 class Methods {
 public:
     int (*sign_on) (int grid_queue_id);
     void (*sign_off) ();
     bool (*choose_experiment) (int grid_queue_id, Experiment &chosen_exp);
 
-    int (*db_fetch_job) (int client_id, int grid_queue_id, int experiment_id, int solver_binary_id, Job& job);
+    int (*db_fetch_jobs) (int client_id, int grid_queue_id, int experiment_id, int solver_binary_id, int num_jobs,
+                          int max_runtime, int max_memory, const LocalResources& local_resources, vector<Job>& jobs);
     int (*db_update_job)(const Job& job);
+    int (*db_update_start_time)(int job_id);
     int (*increment_core_count) (int client_id, int experiment_id);
 };
 
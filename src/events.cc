@@ -0,0 +1,127 @@
+#include <sys/epoll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <ctime>
+#include "events.h"
+#include "log.h"
+
+// maximum number of epoll events that are fetched with one epoll_wait call
+static const int MAX_EVENTS = 16;
+
+static int epoll_fd = -1;
+// self-pipe: written to by the SIGCHLD handler and by other threads, read by the main loop
+static int wakeup_pipe[2] = {-1, -1};
+
+/**
+ * Writes a single byte into the wakeup pipe. This is async-signal-safe and
+ * may be called from signal handlers and from any thread.
+ */
+static void write_wakeup_byte() {
+    int saved_errno = errno;
+    char c = 0;
+    // if the pipe is full, the main loop will wake up anyway
+    if (write(wakeup_pipe[1], &c, 1) == -1) {}
+    errno = saved_errno;
+}
+
+/**
+ * SIGCHLD handler, wakes up the main loop when a child process terminated.
+ */
+static void sigchld_handler(int) {
+    write_wakeup_byte();
+}
+
+/**
+ * Initializes the event loop: creates the epoll instance and the wakeup pipe and installs
+ * the SIGCHLD handler that wakes up <code>events_wait()</code> whenever a job terminates.
+ *
+ * @return 1 on success, 0 on errors
+ */
+int events_init() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        log_error(AT, "Couldn't create epoll instance");
+        return 0;
+    }
+    if (pipe2(wakeup_pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+        log_error(AT, "Couldn't create wakeup pipe");
+        return 0;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = wakeup_pipe[0];
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_pipe[0], &ev) == -1) {
+        log_error(AT, "Couldn't add wakeup pipe to epoll instance");
+        return 0;
+    }
+
+    struct sigaction action;
+    action.sa_handler = sigchld_handler;
+    sigemptyset(&action.sa_mask);
+    // restart interrupted system calls, we are only interested in terminated children
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    if (sigaction(SIGCHLD, &action, NULL) == -1) {
+        log_error(AT, "Couldn't install SIGCHLD handler");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Wakes up the main loop if it is currently blocked in <code>events_wait()</code>
+ * or makes the next call return immediately. May be called from any thread.
+ */
+void events_notify() {
+    if (wakeup_pipe[1] != -1) {
+        write_wakeup_byte();
+    }
+}
+
+/**
+ * Blocks until a child process terminated, <code>events_notify()</code> was called
+ * or <code>timeout</code> milliseconds passed.
+ *
+ * @param timeout timeout in ms, -1 means wait indefinitely
+ * @return the number of events, 0 on timeout or interrupts
+ */
+int events_wait(int timeout) {
+    struct epoll_event evs[MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, evs, MAX_EVENTS, timeout);
+    if (n == -1) {
+        if (errno != EINTR) {
+            log_error(AT, "epoll_wait failed");
+        }
+        return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        if (evs[i].data.fd == wakeup_pipe[0]) {
+            // drain the pipe, the callers check all sources anyway
+            char buf[256];
+            while (read(wakeup_pipe[0], buf, sizeof(buf)) > 0);
+        }
+    }
+    return n;
+}
+
+/**
+ * Blocks SIGCHLD in the calling thread so that it is always delivered to the main thread.
+ * Should be called by every thread the client starts.
+ */
+void events_block_sigchld() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+/**
+ * Returns the time (s) of the monotonic clock, which isn't affected by changes of the
+ * system time. Used to measure durations and for timeouts.
+ */
+double monotonic_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,10 @@
+#ifndef __events_h__
+#define __events_h__
+
+extern int events_init();
+extern void events_notify();
+extern int events_wait(int timeout);
+extern void events_block_sigchld();
+extern double monotonic_time();
+
+#endif
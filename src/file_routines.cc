@@ -286,3 +286,24 @@ int copy_directory(string from, string to) {
     return 1;
 }
 
+/**
+ * Puts the names of the subdirectories of <code>path</code> in <code>names</code>.
+ * @param path
+ * @param names
+ * @return 1 on success, 0 on errors
+ */
+int list_directories(const string& path, vector<string>& names) {
+    DIR *dp;
+    struct dirent *dirp;
+    if ((dp = opendir(path.c_str())) == NULL) {
+        return 0;
+    }
+    while ((dirp = readdir(dp)) != NULL) {
+        string file = string(dirp->d_name);
+        if (dirp->d_type == DT_DIR && file != "." && file != "..") {
+            names.push_back(file);
+        }
+    }
+    closedir(dp);
+    return 1;
+}
@@ -2,8 +2,10 @@
 #define __file_routines_h__
 #include <stdlib.h>
 #include <string>
+#include <vector>
 
 using std::string;
+using std::vector;
 
 int rename(const string& old_path, const string& new_path);
 int create_directory(const string& path);
@@ -18,4 +20,5 @@ string extract_directory(const string& path);
 int create_directories(const string& path);
 int copy_file(string from, string to);
 int copy_directory(string from, string to);
+int list_directories(const string& path, vector<string>& names);
 #endif
@@ -314,3 +314,26 @@ unsigned long long int get_free_system_memory() {
     }
     return info.freeram;
 }
+
+/**
+ * Returns the amount of memory in bytes that is available for starting new processes
+ * without swapping. This includes page cache that can be reclaimed and is taken from
+ * MemAvailable in /proc/meminfo, on older kernels free and buffer memory are used.
+ */
+unsigned long long int get_available_system_memory() {
+    ifstream meminfo("/proc/meminfo");
+    string key;
+    unsigned long long int value;
+    while (meminfo >> key >> value) {
+        if (key == "MemAvailable:") {
+            return value * 1024;
+        }
+        meminfo.ignore(256, '\n');
+    }
+    struct sysinfo info;
+    if (sysinfo(&info) != 0) {
+        perror("sysinfo");
+        return 0;
+    }
+    return (unsigned long long int) (info.freeram + info.bufferram) * info.mem_unit;
+}
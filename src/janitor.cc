@@ -0,0 +1,232 @@
+#include <pthread.h>
+#include <signal.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <deque>
+#include <utility>
+#include "janitor.h"
+#include "cgroup.h"
+#include "log.h"
+
+using namespace std;
+
+/**
+ * The janitor removes the temporary directories and output files of finished jobs in a
+ * background thread, so that solvers that leave many or large files behind don't delay the
+ * result threads. Directories are removed with unlinkat() without following symbolic links.
+ * Temporary directories can be size-capped tmpfs mounts, which are simply unmounted.
+ * The cgroups of finished jobs are removed, too, because killed processes may take a moment
+ * to leave them.
+ */
+
+// maximum depth of the directory trees that are removed, each level needs a file descriptor
+const int MAX_REMOVE_DEPTH = 128;
+
+static pthread_t thread;
+static pthread_mutex_t janitor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t janitor_cond = PTHREAD_COND_INITIALIZER;
+static bool started = false;
+// set when the client exits, the thread finishes after the queue is empty
+static bool finishing;
+// paths that still have to be removed and whether they are cgroups
+static deque<pair<string, bool> > queued_paths;
+// whether mounting a tmpfs failed, the temporary directories are plain directories then
+static bool tmpfs_failed = false;
+
+/**
+ * Removes the entries of the directory <code>dir_fd</code> recursively. Directories without
+ * write or search permission (e.g. changed by the solver) are made accessible first.
+ *
+ * @return false if not everything could be removed
+ */
+static bool remove_directory_entries(int dir_fd, int depth) {
+    DIR* dir = fdopendir(dir_fd);
+    if (dir == NULL) {
+        close(dir_fd);
+        return false;
+    }
+    bool ok = true;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char* name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        bool is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (!is_dir) {
+            if (unlinkat(dirfd(dir), name, 0) != 0 && errno != ENOENT) ok = false;
+            continue;
+        }
+        if (depth >= MAX_REMOVE_DEPTH) {
+            ok = false;
+            continue;
+        }
+        int fd = openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1 && errno == EACCES && fchmodat(dirfd(dir), name, 0700, 0) == 0) {
+            fd = openat(dirfd(dir), name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        }
+        if (fd == -1) {
+            ok = false;
+            continue;
+        }
+        fchmod(fd, 0700);
+        ok = remove_directory_entries(fd, depth + 1) && ok;
+        if (unlinkat(dirfd(dir), name, AT_REMOVEDIR) != 0 && errno != ENOENT) ok = false;
+    }
+    closedir(dir);
+    return ok;
+}
+
+/**
+ * Removes the file or directory <code>path</code>. A directory that is a mount point
+ * (see create_tempdir()) is unmounted, which releases its contents at once.
+ */
+static bool remove_path(const string& path) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        return errno == ENOENT;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return unlink(path.c_str()) == 0 || errno == ENOENT;
+    }
+    struct stat parent;
+    if (stat((path + "/..").c_str(), &parent) == 0 && parent.st_dev != st.st_dev
+            && umount2(path.c_str(), MNT_DETACH) == 0) {
+        return rmdir(path.c_str()) == 0;
+    }
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1 && errno == EACCES && chmod(path.c_str(), 0700) == 0) {
+        fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    if (fd == -1) {
+        return false;
+    }
+    bool ok = remove_directory_entries(fd, 0);
+    return rmdir(path.c_str()) == 0 && ok;
+}
+
+void* janitor_thread(void*) {
+    // signals are handled by the main thread
+    sigset_t set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    pthread_mutex_lock(&janitor_mutex);
+    while (true) {
+        if (queued_paths.empty()) {
+            if (finishing) break;
+            pthread_cond_wait(&janitor_cond, &janitor_mutex);
+            continue;
+        }
+        pair<string, bool> entry = queued_paths.front();
+        queued_paths.pop_front();
+        pthread_mutex_unlock(&janitor_mutex);
+
+        if (entry.second) {
+            cgroup_remove(entry.first);
+        } else if (!remove_path(entry.first)) {
+            log_message(LOG_IMPORTANT, "Could not remove %s: %s", entry.first.c_str(), strerror(errno));
+        }
+
+        pthread_mutex_lock(&janitor_mutex);
+    }
+    pthread_mutex_unlock(&janitor_mutex);
+    return NULL;
+}
+
+void start_janitor_thread() {
+    finishing = false;
+    started = true;
+    pthread_create(&thread, NULL, janitor_thread, NULL);
+}
+
+/**
+ * Stops the janitor thread after the queued paths were removed.
+ */
+void stop_janitor_thread() {
+    if (!started) {
+        return;
+    }
+    pthread_mutex_lock(&janitor_mutex);
+    finishing = true;
+    pthread_cond_signal(&janitor_cond);
+    pthread_mutex_unlock(&janitor_mutex);
+    pthread_join(thread, NULL);
+    started = false;
+}
+
+/**
+ * Queues the file or directory <code>path</code> for removal by the janitor thread. If the
+ * thread isn't running, it is removed at once.
+ *
+ * @param path the file or directory
+ */
+void janitor_remove(const string& path) {
+    pthread_mutex_lock(&janitor_mutex);
+    if (started && !finishing) {
+        queued_paths.push_back(make_pair(path, false));
+        pthread_cond_signal(&janitor_cond);
+        pthread_mutex_unlock(&janitor_mutex);
+        return;
+    }
+    pthread_mutex_unlock(&janitor_mutex);
+    if (!remove_path(path)) {
+        log_message(LOG_IMPORTANT, "Could not remove %s: %s", path.c_str(), strerror(errno));
+    }
+}
+
+/**
+ * Queues the cgroup <code>path</code> for removal by the janitor thread, see cgroup_remove().
+ * If the thread isn't running, it is removed at once.
+ *
+ * @param path the cgroup
+ */
+void janitor_remove_cgroup(const string& path) {
+    pthread_mutex_lock(&janitor_mutex);
+    if (started && !finishing) {
+        queued_paths.push_back(make_pair(path, true));
+        pthread_cond_signal(&janitor_cond);
+        pthread_mutex_unlock(&janitor_mutex);
+        return;
+    }
+    pthread_mutex_unlock(&janitor_mutex);
+    cgroup_remove(path);
+}
+
+/**
+ * Creates the temporary directory of a job. If <code>size_limit</code> is positive, a tmpfs
+ * of this size (MB) is mounted on it, so that the files of the job are kept in memory and a
+ * solver writing too much gets ENOSPC instead of filling the disk. The pages of the tmpfs are
+ * charged to the memory cgroup of the job. Mounting requires CAP_SYS_ADMIN, if it fails once
+ * plain directories are used from then on.
+ *
+ * @param path the directory
+ * @param size_limit size (MB) of the tmpfs, 0 for a plain directory
+ * @return true on success
+ */
+bool create_tempdir(const string& path, int size_limit) {
+    if (mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
+        return false;
+    }
+    if (size_limit <= 0 || tmpfs_failed) {
+        return true;
+    }
+    ostringstream options;
+    options << "size=" << size_limit << "m,mode=0777";
+    if (mount("tmpfs", path.c_str(), "tmpfs", MS_NOSUID | MS_NODEV, options.str().c_str()) != 0) {
+        tmpfs_failed = true;
+        log_message(LOG_IMPORTANT, "WARNING: Could not mount a tmpfs on %s, using plain temporary directories: %s",
+                    path.c_str(), strerror(errno));
+    }
+    return true;
+}
@@ -0,0 +1,12 @@
+#ifndef __janitor_h__
+#define __janitor_h__
+
+#include <string>
+
+void start_janitor_thread();
+void stop_janitor_thread();
+void janitor_remove(const std::string& path);
+void janitor_remove_cgroup(const std::string& path);
+bool create_tempdir(const std::string& path, int size_limit);
+
+#endif
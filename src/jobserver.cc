@@ -18,10 +18,11 @@
 #include "log.h"
 #include "md5sum.h"
 
-static int client_protocol_version = 3;
+static int client_protocol_version = 4;
 
 Jobserver::Jobserver(string hostname, string database, string username, string password, int port) {
     this->connected = false;
+    this->interrupted = false;
     this->fd = -1;
     this->hostname = hostname;
     this->database = database;
@@ -31,6 +32,9 @@ Jobserver::Jobserver(string hostname, string database, string username, string p
 }
 
 bool Jobserver::connectToJobserver() {
+    if (interrupted) {
+        return false;
+    }
     if (fd != -1) {
         log_message(LOG_IMPORTANT, "Disconnecting from Job Server caused by previous errors (maybe out of sync or job server shutdown).");
         close(fd);
@@ -117,6 +121,9 @@ bool Jobserver::connectToJobserver() {
 }
 
 bool Jobserver::checkConnection() {
+    if (interrupted) {
+        return false;
+    }
     if (!connected) {
         log_message(LOG_IMPORTANT, "Not connected to jobserver. Waiting 5 seconds..");
         sleep(5);
@@ -215,3 +222,76 @@ bool Jobserver::getJobId(int experiment_id, int solver_binary_id, int &idJob) {
     log_message(LOG_DEBUG, "Received job id: %d", idJob);
     return true;
 }
+
+/**
+ * Long poll for a job (function id 2, since protocol version 4). The job server blocks until
+ * there is a job of one of the experiments of the grid queue or the timeout expired.
+ * Answers the experiment id and the job id, the job id is -1 on timeout.
+ */
+bool Jobserver::waitForJobId(int grid_queue_id, int solver_binary_id, int timeout, int &experiment_id, int &idJob) {
+    if (!checkConnection()) {
+        return false;
+    }
+    log_message(LOG_DEBUG, "Waiting for a job: sending grid queue id %d, solver binary id %d, timeout %d ms to job server..", grid_queue_id, solver_binary_id, timeout);
+    short func_id = htons(2);
+    int grid_queue_id_nw = htonl(grid_queue_id);
+    int sb_id_nw = htonl(solver_binary_id);
+    int timeout_nw = htonl(timeout);
+    int retval;
+    retval = write(fd, &func_id, 2);
+    if (retval != 2) {
+        log_error(AT, "Error while sending function id.");
+        connected = false;
+        return false;
+    }
+    retval = write(fd, &grid_queue_id_nw, 4);
+    if (retval != 4) {
+        log_error(AT, "Error while sending grid queue id.");
+        connected = false;
+        return false;
+    }
+    retval = write(fd, &sb_id_nw, 4);
+    if (retval != 4) {
+        log_error(AT, "Error while sending solver binary id.");
+        connected = false;
+        return false;
+    }
+    retval = write(fd, &timeout_nw, 4);
+    if (retval != 4) {
+        log_error(AT, "Error while sending timeout.");
+        connected = false;
+        return false;
+    }
+    retval = read(fd, &experiment_id, 4);
+    if (retval != 4 && interrupted) {
+        log_message(LOG_DEBUG, "Stopped waiting for a job.");
+        connected = false;
+        return false;
+    }
+    if (retval != 4) {
+        log_error(AT, "Error while reading experiment id.");
+        connected = false;
+        return false;
+    }
+    experiment_id = ntohl(experiment_id);
+    retval = read(fd, &idJob, 4);
+    if (retval != 4) {
+        log_error(AT, "Error while reading job id.");
+        connected = false;
+        return false;
+    }
+    idJob = ntohl(idJob);
+    log_message(LOG_DEBUG, "Received experiment id %d, job id: %d", experiment_id, idJob);
+    return true;
+}
+
+/**
+ * Ends a waitForJobId() call of another thread at once by shutting the connection down.
+ * Called when the client exits, the job server isn't used anymore afterwards.
+ */
+void Jobserver::interrupt() {
+    interrupted = true;
+    if (fd != -1) {
+        shutdown(fd, SHUT_RDWR);
+    }
+}
@@ -13,6 +13,8 @@ using namespace std;
 class Jobserver {
 private:
     bool connected;
+    // set by interrupt(), the connection isn't used anymore
+    volatile bool interrupted;
     int fd;
     string hostname;
     string database;
@@ -25,6 +27,8 @@ public:
     bool connectToJobserver();
     bool getPossibleExperimentIds(int grid_queue_id, string &ids);
     bool getJobId(int experiment_id, int solver_binary_id, int &idJob);
+    bool waitForJobId(int grid_queue_id, int solver_binary_id, int timeout, int &experiment_id, int &idJob);
+    void interrupt();
 };
 
 #endif /* JOBSERVER_HPP_ */
@@ -48,10 +48,15 @@ int log_init(string filename, int verbosity) {
 }
 
 /**
- * Closes the logfile.
+ * Closes the logfile. Further log output of background threads goes to stdout.
  */
 void log_close() {
-    fclose(logfile);
+    pthread_mutex_lock(&log_mutex);
+    if (logfile != stdout) {
+        fclose(logfile);
+        logfile = stdout;
+    }
+    pthread_mutex_unlock(&log_mutex);
 }
 
 /**
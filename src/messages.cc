@@ -6,6 +6,7 @@
 #include "messages.h"
 #include "log.h"
 #include "database.h"
+#include "events.h"
 
 
 using namespace std;
@@ -55,12 +56,18 @@ void check_message() {
     //reset_signal_handler();
     stringstream str(message);
     string line;
+    bool got_message = false;
     pthread_mutex_lock(&msgs_mutex);
     while (getline(str, line)) {
         log_message(LOG_DEBUG, "Got message: %s", line.c_str());
         msgs.push_back(line);
+        got_message = true;
     }
     pthread_mutex_unlock(&msgs_mutex);
+    if (got_message) {
+        // wake up the main loop to process the messages
+        events_notify();
+    }
     log_message(LOG_DEBUG, "End of checking message.");
 }
 
@@ -70,6 +77,8 @@ void check_message() {
 void *message_thread(void*) {
     // initialize signal handler, now sleep can be interrupted
     signal(SIGINT, message_thread_sighandler);
+    // terminated jobs are handled by the main thread
+    events_block_sigchld();
 
     log_message(LOG_INFO, "Message thread started.");
     if (!get_new_connection(connection)) {
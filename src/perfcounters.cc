@@ -0,0 +1,105 @@
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <cerrno>
+#include <cstring>
+#include "perfcounters.h"
+#include "log.h"
+
+using namespace std;
+
+/**
+ * Performance counters of the processes of a job. The counters are attached to the job's
+ * process before it calls execve() and are inherited by all processes it creates, so the
+ * totals cover runsolver (or the solver) and all its children. Instruction counts hardly
+ * depend on the load of the machine, unlike the CPU time.
+ */
+
+struct PerfEvent {
+    const char* name;
+    unsigned int type;
+    unsigned long long config;
+    // whether the event is counted in kernel mode too
+    bool kernel;
+};
+
+// in the order of the fields of PerfCounterValues
+static const PerfEvent PERF_EVENTS[] = {
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, false },
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, false },
+    { "LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, false },
+    // context switches happen in the kernel, so they aren't counted in user mode
+    { "context switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, true }
+};
+static const int NUM_PERF_EVENTS = sizeof(PERF_EVENTS) / sizeof(PERF_EVENTS[0]);
+
+// whether failing events were logged already, they fail for every job
+static bool logged_errors[NUM_PERF_EVENTS];
+
+/**
+ * Attaches the counters to the process <code>pid</code>, which must not have called execve() yet.
+ * The counters start when it calls execve() and count all its threads and child processes.
+ * Counters that aren't supported by the CPU or not permitted (see
+ * /proc/sys/kernel/perf_event_paranoid) get the file descriptor -1.
+ *
+ * @param pid the process
+ * @param fds vector the file descriptors of the counters are stored in
+ */
+void perf_counters_open(pid_t pid, vector<int>& fds) {
+    fds.assign(NUM_PERF_EVENTS, -1);
+    for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_EVENTS[i].type;
+        attr.config = PERF_EVENTS[i].config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.disabled = 1;
+        attr.enable_on_exec = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = PERF_EVENTS[i].kernel ? 0 : 1;
+        attr.exclude_hv = 1;
+        fds[i] = syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fds[i] == -1 && !logged_errors[i]) {
+            logged_errors[i] = true;
+            log_message(LOG_IMPORTANT, "WARNING: Could not open the performance counter of the %s: %s",
+                        PERF_EVENTS[i].name, strerror(errno));
+        }
+    }
+}
+
+/**
+ * Reads the totals of the counters. Counters that were multiplexed with other events
+ * because the CPU has too few counter registers are scaled up to the whole run time.
+ * Must be called after the processes of the job ended, the counts of child processes are
+ * added when they exit.
+ *
+ * @param fds the file descriptors of the counters, see perf_counters_open()
+ * @param values where the totals are stored
+ */
+void perf_counters_read(const vector<int>& fds, PerfCounterValues& values) {
+    long long* totals[] = { &values.instructions, &values.cycles, &values.llc_misses, &values.context_switches };
+    for (int i = 0; i < NUM_PERF_EVENTS && i < (int)fds.size(); i++) {
+        // value, time enabled, time running
+        unsigned long long data[3];
+        if (fds[i] == -1 || read(fds[i], data, sizeof(data)) != sizeof(data) || data[1] == 0) {
+            continue;
+        }
+        if (data[2] == 0) {
+            // the counter never got a register
+            continue;
+        }
+        if (data[2] < data[1]) {
+            *totals[i] = (long long)((double)data[0] * data[1] / data[2]);
+        } else {
+            *totals[i] = (long long)data[0];
+        }
+    }
+}
+
+void perf_counters_close(vector<int>& fds) {
+    for (unsigned int i = 0; i < fds.size(); i++) {
+        if (fds[i] != -1) close(fds[i]);
+    }
+    fds.clear();
+}
@@ -0,0 +1,25 @@
+#ifndef __perfcounters_h__
+#define __perfcounters_h__
+
+#include <vector>
+#include <sys/types.h>
+
+/**
+ * Totals of the performance counters of a job, -1 if a counter isn't available.
+ */
+struct PerfCounterValues {
+    // instructions retired and CPU cycles in user space
+    long long instructions, cycles;
+    // last level cache misses
+    long long llc_misses;
+    // voluntary and involuntary context switches
+    long long context_switches;
+
+    PerfCounterValues() : instructions(-1), cycles(-1), llc_misses(-1), context_switches(-1) {}
+};
+
+void perf_counters_open(pid_t pid, std::vector<int>& fds);
+void perf_counters_read(const std::vector<int>& fds, PerfCounterValues& values);
+void perf_counters_close(std::vector<int>& fds);
+
+#endif
@@ -0,0 +1,97 @@
+#include <pthread.h>
+#include <map>
+#include <utility>
+#include "predictor.h"
+#include "log.h"
+#include "database.h"
+
+using namespace std;
+
+/**
+ * Sum and number of observed run times.
+ */
+class RuntimeStats {
+public:
+    double sum;
+    int count;
+
+    RuntimeStats() : sum(0), count(0) {}
+    void add(double runtime) { sum += runtime; count++; }
+    double mean() const { return sum / count; }
+};
+
+// predict_runtime() is called by the prefetch thread, predictor_add_result() by the result threads
+static pthread_mutex_t predictor_mutex = PTHREAD_MUTEX_INITIALIZER;
+// run times by (solver config, instance), initialized from the database on first use
+static map<pair<int, int>, RuntimeStats> stats_by_config_instance;
+// run times of the jobs of each solver config that were processed by this client
+static map<int, RuntimeStats> stats_by_config;
+
+/**
+ * Predicts the run time of a job. The prediction is the average run time of
+ * the finished runs of the job's solver config on the job's instance. If there are
+ * none, the runs of the solver binary on the instance in the job's experiment are used.
+ * Otherwise the average run time of the solver config on the instances this client
+ * processed so far is used. The database is only queried once per solver config and instance.
+ * The solver binary of the job has to be known.
+ *
+ * @param job the job
+ * @return the predicted run time (s), -1 if nothing is known about the job
+ */
+double predict_runtime(const Job& job) {
+    pair<int, int> key(job.idSolverConfig, job.idInstance);
+    pthread_mutex_lock(&predictor_mutex);
+    map<pair<int, int>, RuntimeStats>::iterator it = stats_by_config_instance.find(key);
+    if (it != stats_by_config_instance.end()) {
+        double runtime = it->second.count > 0 ? it->second.mean() : -1;
+        pthread_mutex_unlock(&predictor_mutex);
+        if (runtime >= 0) return runtime;
+    } else {
+        pthread_mutex_unlock(&predictor_mutex);
+        double runtime;
+        int count;
+        if (!get_runtime_history(job.idExperiment, job.idSolverConfig, job.idSolverBinary, job.idInstance, runtime, count)) {
+            count = 0;
+        }
+        pthread_mutex_lock(&predictor_mutex);
+        // results of this client might have been added meanwhile
+        RuntimeStats& stats = stats_by_config_instance[key];
+        if (count > 0) {
+            stats.sum += runtime * count;
+            stats.count += count;
+        }
+        double prediction = stats.count > 0 ? stats.mean() : -1;
+        pthread_mutex_unlock(&predictor_mutex);
+        if (prediction >= 0) return prediction;
+    }
+
+    double prediction = -1;
+    pthread_mutex_lock(&predictor_mutex);
+    map<int, RuntimeStats>::iterator config_it = stats_by_config.find(job.idSolverConfig);
+    if (config_it != stats_by_config.end()) {
+        prediction = config_it->second.mean();
+    }
+    pthread_mutex_unlock(&predictor_mutex);
+    return prediction;
+}
+
+/**
+ * Adds the run time of a job that was processed by this client to the predictions.
+ * Jobs that didn't finish (crashes, client errors) are ignored.
+ *
+ * @param job the job whose results were processed
+ */
+void predictor_add_result(const Job& job) {
+    if (job.status < 1 || job.resultTime < 0) {
+        return;
+    }
+    pthread_mutex_lock(&predictor_mutex);
+    map<pair<int, int>, RuntimeStats>::iterator it = stats_by_config_instance.find(make_pair(job.idSolverConfig, job.idInstance));
+    // if the database wasn't queried yet, it's done on the next prediction and includes this result
+    if (it != stats_by_config_instance.end()) {
+        it->second.add(job.resultTime);
+    }
+    stats_by_config[job.idSolverConfig].add(job.resultTime);
+    pthread_mutex_unlock(&predictor_mutex);
+    log_message(LOG_DEBUG, "[Job %d] Run time %f s added to the run time predictions", job.idJob, job.resultTime);
+}
@@ -0,0 +1,9 @@
+#ifndef __predictor_h__
+#define __predictor_h__
+
+#include "datastructures.h"
+
+double predict_runtime(const Job& job);
+void predictor_add_result(const Job& job);
+
+#endif
@@ -0,0 +1,574 @@
+#include <pthread.h>
+#include <signal.h>
+#include <ctime>
+#include <cmath>
+#include <cerrno>
+#include <deque>
+#include <vector>
+#include "prefetch.h"
+#include "log.h"
+#include "database.h"
+#include "events.h"
+
+using namespace std;
+
+// from client.cc
+extern int claim_jobs(int solver_binary_id, int num_jobs, int max_memory, vector<Job>& jobs);
+extern int wait_for_jobs(int grid_queue_id, int solver_binary_id, int timeout, int max_memory, vector<Job>& jobs);
+extern bool prepare_job(PreparedJob& prepared_job);
+extern int reclaim_leases(int lease_time);
+
+// how long (ms) the job server is asked to wait for a job if there are no jobs
+static const int LONG_POLL_TIMEOUT = 30000;
+// weight of a new measurement in the moving averages of the job run time and preparation time
+static const double AVERAGE_WEIGHT = 0.2;
+// the shortest jobs are started first if the remaining walltime is less than this many average run times
+static const double NEAR_END_RUNTIMES = 2.0;
+// interval (s) between handing back the expired leases of other clients, see reclaim_leases()
+static const double RECLAIM_INTERVAL = 60.0;
+// how long (s) the prefetch thread waits before it tries to connect to the database again
+static const int RECONNECT_INTERVAL = 10;
+// how long (s) stop_prefetch_thread() waits for the thread to finish its database queries
+static const int STOP_TIMEOUT = 10;
+
+static pthread_t thread;
+static pthread_mutex_t prefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+// signalled when the thread starts to download the resources of a job, finishes an update of
+// such a job or exits
+static pthread_cond_t stopped_cond = PTHREAD_COND_INITIALIZER;
+static bool finished;
+// whether the thread is running, whether it downloads the resources of a job right now and
+// whether it writes that job to the database, see prefetch_begin_update()
+static bool running = false;
+static bool preparing = false;
+static bool updating = false;
+
+static int grid_queue_id;
+static int num_workers;
+// minimum number of jobs to prepare in addition to the jobs needed by idle workers
+static int min_lookahead_jobs;
+static bool allow_different_solver_binaries;
+// the interval (ms) between trying to claim a job is doubled after each unsuccessful try up to max_interval
+static unsigned int min_interval, max_interval;
+// time (s) after which a claimed job that wasn't started is handed back, 0 means never.
+// The jobs leased by clients that stopped reporting for this time are handed back, too.
+static time_t lease_time;
+// maximum number of jobs that are claimed for one solver binary in a row, 0 disables the grouping
+static int solver_group_budget;
+
+// the solver binary of the current group and the number of jobs claimed for it,
+// -1 if the solver binary of the next prepared job starts a new group
+static int group_solver_binary_id = -1;
+static int group_num_jobs = 0;
+
+// set by the main loop
+static int num_idle_workers = 0;
+static int running_solver_binary_id = -1;
+static int max_memory_limit = -1;
+
+// jobs that are ready to be launched
+static deque<PreparedJob> ready_jobs;
+// ids of the claimed jobs whose resources are not downloaded yet
+static deque<int> preparing_job_ids;
+// ids of the ready jobs that can't finish within the client's walltime or need more memory
+// than available, they have to be reset
+static vector<int> discarded_job_ids;
+
+// moving averages (s) of the run time of a job and the time needed to claim and prepare a job,
+// 0 if unknown
+static double average_runtime = 0;
+static double average_prepare_time = 0;
+
+// set if the last claim got less jobs than requested, the experiments are about to finish
+static bool running_dry = false;
+// whether the ready jobs with the shortest predicted run time are started first, see prefetch_update_jobs()
+static bool shortest_first = false;
+
+static void update_average(double& average, double value) {
+    average = average == 0 ? value : (1 - AVERAGE_WEIGHT) * average + AVERAGE_WEIGHT * value;
+}
+
+/**
+ * Returns the number of jobs that should be ready in addition to the jobs needed by idle workers.
+ * While a job is claimed and prepared, <code>num_workers * prepare time / run time</code> workers
+ * finish on average. The prefetch mutex has to be locked by the caller.
+ */
+static int num_lookahead_jobs() {
+    if (average_runtime == 0 || average_prepare_time == 0) {
+        return min_lookahead_jobs;
+    }
+    int lookahead = (int) ceil(num_workers * average_prepare_time / average_runtime);
+    if (lookahead > num_workers) lookahead = num_workers;
+    return lookahead > min_lookahead_jobs ? lookahead : min_lookahead_jobs;
+}
+
+/**
+ * Returns the absolute time (CLOCK_REALTIME) <code>ms</code> milliseconds from now.
+ */
+static struct timespec deadline(unsigned int ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+/**
+ * Waits on the prefetch condition for at most <code>ms</code> milliseconds.
+ * The prefetch mutex has to be locked by the caller.
+ */
+static void timed_wait(unsigned int ms) {
+    struct timespec ts = deadline(ms);
+    pthread_cond_timedwait(&prefetch_cond, &prefetch_mutex, &ts);
+}
+
+/**
+ * Removes the ready jobs whose lease expired from the queue and puts their ids in <code>job_ids</code>.
+ * The prefetch mutex has to be locked by the caller.
+ *
+ * @return the number of seconds until the next lease expires, -1 if there's none
+ */
+static int expire_leases(vector<int>& job_ids) {
+    if (lease_time == 0) return -1;
+    time_t now = time(NULL);
+    int next_expiry = -1;
+    for (deque<PreparedJob>::iterator it = ready_jobs.begin(); it != ready_jobs.end(); ) {
+        time_t expires = it->claim_time + lease_time;
+        if (expires <= now) {
+            job_ids.push_back(it->job.idJob);
+            it = ready_jobs.erase(it);
+            continue;
+        }
+        if (next_expiry == -1 || expires - now < next_expiry) next_expiry = expires - now;
+        ++it;
+    }
+    return next_expiry;
+}
+
+/**
+ * Counts a prepared job for the solver binary group. The first prepared job after a switch
+ * determines the solver binary of the new group. When the budget of the group is used up,
+ * the next job starts a new group so that other solver binaries get their turn.
+ * The prefetch mutex has to be locked by the caller.
+ */
+static void count_group_job(int solver_binary_id) {
+    if (group_solver_binary_id == -1) {
+        log_message(LOG_DEBUG, "Claiming the jobs of solver binary %d in a row.", solver_binary_id);
+        group_solver_binary_id = solver_binary_id;
+        group_num_jobs = 0;
+    }
+    if (solver_binary_id != group_solver_binary_id) {
+        return;
+    }
+    if (++group_num_jobs >= solver_group_budget) {
+        log_message(LOG_DEBUG, "Claimed %d jobs of solver binary %d, switching the solver binary.",
+                    group_num_jobs, group_solver_binary_id);
+        group_solver_binary_id = -1;
+        group_num_jobs = 0;
+    }
+}
+
+/**
+ * The prefetch thread. Claims jobs and downloads their resources on its own database
+ * connection until there are enough jobs ready for the idle workers plus the lookahead.
+ * All missing jobs are claimed at once.
+ * Jobs that weren't started within the lease time are handed back to the database. The leases
+ * are also kept in the database: claimed jobs have no start time until they are started. Jobs
+ * leased by clients that didn't report within the lease time are handed back, so they aren't
+ * lost if a client dies.
+ * If the jobs are grouped by solver binary, the jobs of one solver binary are claimed
+ * until there are none left or the group's budget is used up.
+ */
+void *prefetch_thread(void*) {
+    // signals are handled by the main thread
+    sigset_t set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    log_message(LOG_INFO, "Prefetch thread started.");
+    pthread_mutex_lock(&prefetch_mutex);
+    while (!finished) {
+        pthread_mutex_unlock(&prefetch_mutex);
+        bool connected = database_connect_thread();
+        pthread_mutex_lock(&prefetch_mutex);
+        if (connected) break;
+        log_error(AT, "Could not establish database connection for the prefetch thread, retrying in %d seconds.",
+                  RECONNECT_INTERVAL);
+        timed_wait(RECONNECT_INTERVAL * 1000);
+    }
+
+    unsigned int interval = min_interval;
+    double next_reclaim = 0;
+    while (!finished) {
+        vector<int> expired_job_ids;
+        int next_expiry = expire_leases(expired_job_ids);
+        expired_job_ids.insert(expired_job_ids.end(), discarded_job_ids.begin(), discarded_job_ids.end());
+        discarded_job_ids.clear();
+        if (!expired_job_ids.empty()) {
+            pthread_mutex_unlock(&prefetch_mutex);
+            for (vector<int>::iterator it = expired_job_ids.begin(); it != expired_job_ids.end(); ++it) {
+                log_message(LOG_DEBUG, "Lease of job %d expired or job can't be started. Resetting job to \"not started\"", *it);
+                db_reset_job(*it);
+            }
+            pthread_mutex_lock(&prefetch_mutex);
+            continue;
+        }
+        int num_jobs = num_idle_workers + num_lookahead_jobs() - ready_jobs.size();
+        if (num_jobs <= 0) {
+            if (next_expiry == -1) {
+                pthread_cond_wait(&prefetch_cond, &prefetch_mutex);
+            } else {
+                timed_wait(next_expiry * 1000);
+            }
+            continue;
+        }
+        int solver_binary_id = running_solver_binary_id;
+        int max_memory = max_memory_limit;
+        if (!allow_different_solver_binaries && !ready_jobs.empty()) {
+            solver_binary_id = ready_jobs.front().job.idSolverBinary;
+        }
+        if (allow_different_solver_binaries && solver_group_budget > 0) {
+            solver_binary_id = group_solver_binary_id;
+            if (solver_binary_id != -1 && num_jobs > solver_group_budget - group_num_jobs) {
+                num_jobs = solver_group_budget - group_num_jobs;
+            }
+        }
+        if ((!allow_different_solver_binaries || solver_group_budget > 0) && solver_binary_id == -1) {
+            // the solver binary is only known after the first job was prepared
+            num_jobs = 1;
+        }
+        pthread_mutex_unlock(&prefetch_mutex);
+
+        if (lease_time != 0 && monotonic_time() >= next_reclaim) {
+            int num_reclaimed = reclaim_leases(lease_time);
+            if (num_reclaimed > 0) {
+                log_message(LOG_INFO, "Handed back %d jobs leased by clients that stopped reporting.", num_reclaimed);
+            }
+            next_reclaim = monotonic_time() + RECLAIM_INTERVAL;
+        }
+        double t_start = monotonic_time();
+        vector<Job> jobs;
+        bool waited = false;
+        int num_claimed = claim_jobs(solver_binary_id, num_jobs, max_memory, jobs);
+        if (num_claimed == 0 && allow_different_solver_binaries && solver_group_budget > 0 && solver_binary_id != -1) {
+            // the group's solver binary has no jobs left, switch to another solver binary right away
+            log_message(LOG_DEBUG, "No jobs of solver binary %d left, switching the solver binary.", solver_binary_id);
+            pthread_mutex_lock(&prefetch_mutex);
+            group_solver_binary_id = -1;
+            group_num_jobs = 0;
+            continue;
+        }
+        if (num_claimed == 0) {
+            // let the job server wake us up when there are new jobs, this fails without job server
+            waited = wait_for_jobs(grid_queue_id, solver_binary_id, LONG_POLL_TIMEOUT, max_memory, jobs) != -1;
+            // the waiting time doesn't count as preparation time
+            t_start = monotonic_time();
+        }
+        time_t claim_time = time(NULL);
+
+        pthread_mutex_lock(&prefetch_mutex);
+        if (finished) {
+            // the client is exiting and didn't know about these jobs
+            pthread_mutex_unlock(&prefetch_mutex);
+            for (vector<Job>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+                db_reset_job(it->idJob);
+            }
+            pthread_mutex_lock(&prefetch_mutex);
+            break;
+        }
+        // from here on stop_prefetch_thread() resets the jobs
+        for (vector<Job>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+            preparing_job_ids.push_back(it->idJob);
+        }
+        running_dry = (int)jobs.size() < num_jobs;
+        if (jobs.empty() && waited) {
+            continue;
+        }
+        if (jobs.empty()) {
+            // if there's no job, increase the interval to reduce the load on the database,
+            // freed worker slots wake the thread up earlier
+            timed_wait(interval);
+            interval = interval * 2 > max_interval ? max_interval : interval * 2;
+            continue;
+        }
+        interval = min_interval;
+
+        // prepare the jobs one after another so that the first job can be started early
+        for (vector<Job>::iterator it = jobs.begin(); it != jobs.end() && !finished; ++it) {
+            // stop_prefetch_thread() doesn't wait for downloads
+            preparing = true;
+            pthread_cond_broadcast(&stopped_cond);
+            pthread_mutex_unlock(&prefetch_mutex);
+            PreparedJob prepared_job;
+            prepared_job.job = *it;
+            prepared_job.claim_time = claim_time;
+            prepared_job.predicted_runtime = -1;
+            bool prepared = prepare_job(prepared_job);
+
+            pthread_mutex_lock(&prefetch_mutex);
+            preparing = false;
+            // if finished is set, the jobs were already reset by stop_prefetch_thread()
+            if (finished) break;
+            preparing_job_ids.pop_front();
+            if (prepared) {
+                ready_jobs.push_back(prepared_job);
+                events_notify();
+                if (allow_different_solver_binaries && solver_group_budget > 0) {
+                    count_group_job(prepared_job.job.idSolverBinary);
+                }
+            }
+        }
+        update_average(average_prepare_time, (monotonic_time() - t_start) / jobs.size());
+    }
+    running = false;
+    pthread_cond_broadcast(&stopped_cond);
+    pthread_mutex_unlock(&prefetch_mutex);
+    database_close_thread();
+    log_message(LOG_INFO, "Prefetch thread finished.");
+    return NULL;
+}
+
+/**
+ * Starts the prefetch thread. This method will return immediately after creating the thread.
+ *
+ * @param _grid_queue_id the id of the grid queue the client is running on
+ * @param _num_workers the number of worker slots
+ * @param _min_lookahead_jobs minimum number of jobs to prepare in advance for workers that are
+ *        still busy. More jobs are prepared if there are many workers and the jobs are short.
+ * @param _allow_different_solver_binaries whether prepared jobs may use different solver binaries
+ * @param _min_interval interval (ms) between tries to claim a job if there are no jobs
+ * @param _max_interval upper limit of the interval (ms), the interval is doubled after each try
+ * @param _lease_time time (s) after which prepared jobs that weren't started are reset, 0 to keep them.
+ *        Jobs leased by clients that didn't report for this time are reset, too.
+ * @param _solver_group_budget maximum number of jobs of one solver binary that are claimed in a row
+ *        before switching to another solver binary, 0 to claim jobs of any solver binary
+ */
+void start_prefetch_thread(int _grid_queue_id, int _num_workers, int _min_lookahead_jobs,
+                           bool _allow_different_solver_binaries, unsigned int _min_interval,
+                           unsigned int _max_interval, time_t _lease_time, int _solver_group_budget) {
+    grid_queue_id = _grid_queue_id;
+    num_workers = _num_workers;
+    min_lookahead_jobs = _min_lookahead_jobs;
+    allow_different_solver_binaries = _allow_different_solver_binaries;
+    min_interval = _min_interval;
+    max_interval = _max_interval;
+    lease_time = _lease_time;
+    solver_group_budget = _solver_group_budget;
+    finished = false;
+    running = true;
+    pthread_create(&thread, NULL, prefetch_thread, NULL);
+}
+
+/**
+ * Stops the prefetch thread and returns the ids of all jobs that were claimed but not
+ * handed over to a worker, including the jobs whose resources are being downloaded.
+ * These jobs have to be reset by the caller.
+ * Waits up to <code>STOP_TIMEOUT</code> seconds until the thread finished, so that no claim or
+ * update of a job is in flight when the jobs are reset. A download isn't waited for, the jobs
+ * aren't written to the database after it (see prefetch_begin_update()).
+ *
+ * @param job_ids vector where the ids of the claimed jobs are put in
+ */
+void stop_prefetch_thread(vector<int>& job_ids) {
+    pthread_mutex_lock(&prefetch_mutex);
+    finished = true;
+    pthread_cond_broadcast(&prefetch_cond);
+    // the long poll for jobs takes longer than STOP_TIMEOUT
+    db_interrupt_wait_for_jobs();
+    struct timespec timeout = deadline(STOP_TIMEOUT * 1000);
+    while (running && (!preparing || updating)) {
+        if (pthread_cond_timedwait(&stopped_cond, &prefetch_mutex, &timeout) == ETIMEDOUT) {
+            log_message(LOG_IMPORTANT, "WARNING: The prefetch thread didn't finish its database queries in time, "
+                                       "jobs claimed by it may stay claimed.");
+            break;
+        }
+    }
+    bool stopped = !running;
+    for (deque<PreparedJob>::iterator it = ready_jobs.begin(); it != ready_jobs.end(); ++it) {
+        job_ids.push_back(it->job.idJob);
+    }
+    ready_jobs.clear();
+    job_ids.insert(job_ids.end(), preparing_job_ids.begin(), preparing_job_ids.end());
+    preparing_job_ids.clear();
+    job_ids.insert(job_ids.end(), discarded_job_ids.begin(), discarded_job_ids.end());
+    discarded_job_ids.clear();
+    pthread_mutex_unlock(&prefetch_mutex);
+    if (stopped) {
+        pthread_join(thread, NULL);
+    }
+}
+
+/**
+ * Called by prepare_job() before it writes the job whose resources are downloaded to the
+ * database. Once the client is exiting, the job is reset by the caller of stop_prefetch_thread()
+ * and mustn't be written anymore.
+ *
+ * @return true if the job may be written, prefetch_end_update() has to be called after it
+ */
+bool prefetch_begin_update() {
+    pthread_mutex_lock(&prefetch_mutex);
+    bool allowed = !finished;
+    updating = allowed;
+    pthread_mutex_unlock(&prefetch_mutex);
+    return allowed;
+}
+
+/**
+ * Called by prepare_job() after it wrote the job, see prefetch_begin_update().
+ */
+void prefetch_end_update() {
+    pthread_mutex_lock(&prefetch_mutex);
+    updating = false;
+    pthread_cond_broadcast(&stopped_cond);
+    pthread_mutex_unlock(&prefetch_mutex);
+}
+
+/**
+ * Tells the prefetch thread how many workers are idle, which solver binary the
+ * running jobs use (-1 if the solver binary doesn't matter) and the largest memory limit (MB)
+ * of the jobs it claims (-1 for any). Should be called by the main loop after filling the idle workers.
+ */
+void prefetch_request(int _num_idle_workers, int solver_binary_id, int _max_memory_limit) {
+    pthread_mutex_lock(&prefetch_mutex);
+    if (_num_idle_workers > num_idle_workers) {
+        pthread_cond_signal(&prefetch_cond);
+    }
+    num_idle_workers = _num_idle_workers;
+    running_solver_binary_id = solver_binary_id;
+    max_memory_limit = _max_memory_limit;
+    pthread_mutex_unlock(&prefetch_mutex);
+}
+
+/**
+ * Removes the ready jobs whose memory limit exceeds <code>max_memory_limit</code> from the queue,
+ * the prefetch thread hands them back to the database. Otherwise these jobs would keep free CPUs
+ * idle until running jobs finish, while other clients might have enough memory for them.
+ *
+ * @param max_memory_limit the maximum memory limit (MB) of the jobs that are kept
+ * @return the number of removed jobs
+ */
+int prefetch_release_jobs(int max_memory_limit) {
+    pthread_mutex_lock(&prefetch_mutex);
+    int num_released = 0;
+    for (deque<PreparedJob>::iterator it = ready_jobs.begin(); it != ready_jobs.end(); ) {
+        if ((it->job.memoryLimit > 0 ? it->job.memoryLimit : 0) > max_memory_limit) {
+            discarded_job_ids.push_back(it->job.idJob);
+            it = ready_jobs.erase(it);
+            num_released++;
+            continue;
+        }
+        ++it;
+    }
+    if (num_released > 0) {
+        pthread_cond_signal(&prefetch_cond);
+    }
+    pthread_mutex_unlock(&prefetch_mutex);
+    return num_released;
+}
+
+/**
+ * Tells the prefetch thread the run time of a finished job. The number of
+ * prepared jobs is adjusted to the average run time.
+ *
+ * @param runtime wall clock time (s) the job was running
+ */
+void prefetch_job_finished(double runtime) {
+    pthread_mutex_lock(&prefetch_mutex);
+    update_average(average_runtime, runtime);
+    pthread_mutex_unlock(&prefetch_mutex);
+}
+
+/**
+ * Removes the ready jobs whose time limit exceeds <code>max_runtime</code> from the queue,
+ * the prefetch thread hands them back to the database. Jobs without time limit are removed, too.
+ * The remaining time only decreases, so these jobs would never be started by this client.
+ *
+ * Also decides in which order the ready jobs are started. The jobs with the longest predicted
+ * run time are started first so that no long job is left over at the end. Near the end of the
+ * walltime or if the experiments run out of jobs, the shortest jobs are started first so that
+ * as many jobs as possible finish.
+ *
+ * @param max_runtime the maximum time limit (s) of the jobs, -1 to keep all jobs
+ */
+void prefetch_update_jobs(int max_runtime) {
+    pthread_mutex_lock(&prefetch_mutex);
+    bool near_end = max_runtime >= 0 && max_runtime < NEAR_END_RUNTIMES * average_runtime;
+    if ((near_end || running_dry) != shortest_first) {
+        shortest_first = near_end || running_dry;
+        log_message(LOG_DEBUG, "Starting the jobs with the %s predicted run time first.", shortest_first ? "shortest" : "longest");
+    }
+    if (max_runtime < 0) {
+        pthread_mutex_unlock(&prefetch_mutex);
+        return;
+    }
+    size_t num_discarded = discarded_job_ids.size();
+    for (deque<PreparedJob>::iterator it = ready_jobs.begin(); it != ready_jobs.end(); ) {
+        const Job& job = it->job;
+        int limit = job.wallClockTimeLimit > 0 ? job.wallClockTimeLimit : job.CPUTimeLimit;
+        if (limit <= 0 || limit > max_runtime) {
+            discarded_job_ids.push_back(job.idJob);
+            it = ready_jobs.erase(it);
+            continue;
+        }
+        ++it;
+    }
+    if (discarded_job_ids.size() > num_discarded) {
+        pthread_cond_signal(&prefetch_cond);
+    }
+    pthread_mutex_unlock(&prefetch_mutex);
+}
+
+/**
+ * Takes the prepared job with the longest (or shortest, see prefetch_update_jobs()) predicted
+ * run time whose memory limit is at most <code>max_memory_limit</code> and which needs at most
+ * <code>max_cpus</code> CPUs (or the entry of its grid queue in <code>max_cpus_by_grid_queue</code>, if any)
+ * from the queue, other jobs stay in the queue. Jobs without prediction
+ * are assumed to run as long as the average job.
+ * Jobs without memory limit always fit unless <code>max_memory_limit</code> is negative.
+ * The start time of the job in the database is set by start_job() when the job is started.
+ *
+ * @param prepared_job reference where the job is put in
+ * @param max_memory_limit the maximum memory limit (MB) of the job
+ * @param max_cpus the maximum number of CPUs of the job
+ * @param max_cpus_by_grid_queue lower maximum numbers of CPUs of the jobs of some grid queues
+ * @return 1 if there was a fitting job, 0 if there are no prepared jobs, -1 if no prepared job fits
+ */
+int prefetch_pop_job(PreparedJob& prepared_job, int max_memory_limit, int max_cpus,
+                     const map<int, int>& max_cpus_by_grid_queue) {
+    pthread_mutex_lock(&prefetch_mutex);
+    if (ready_jobs.empty()) {
+        pthread_mutex_unlock(&prefetch_mutex);
+        return 0;
+    }
+    deque<PreparedJob>::iterator best = ready_jobs.end();
+    double best_runtime = 0;
+    for (deque<PreparedJob>::iterator it = ready_jobs.begin(); it != ready_jobs.end(); ++it) {
+        if ((it->job.memoryLimit > 0 ? it->job.memoryLimit : 0) > max_memory_limit || it->job.numCPUs > max_cpus) {
+            continue;
+        }
+        map<int, int>::const_iterator queue_max_cpus = max_cpus_by_grid_queue.find(it->job.computeQueue);
+        if (queue_max_cpus != max_cpus_by_grid_queue.end() && it->job.numCPUs > queue_max_cpus->second) {
+            continue;
+        }
+        double runtime = it->predicted_runtime >= 0 ? it->predicted_runtime : average_runtime;
+        if (best == ready_jobs.end() || (shortest_first ? runtime < best_runtime : runtime > best_runtime)) {
+            best = it;
+            best_runtime = runtime;
+        }
+    }
+    if (best == ready_jobs.end()) {
+        pthread_mutex_unlock(&prefetch_mutex);
+        return -1;
+    }
+    prepared_job = *best;
+    ready_jobs.erase(best);
+    // there's room for the next job
+    pthread_cond_signal(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_mutex);
+    return 1;
+}
@@ -0,0 +1,22 @@
+#ifndef __prefetch_h__
+#define __prefetch_h__
+
+#include <vector>
+#include <map>
+#include <ctime>
+#include "datastructures.h"
+
+void start_prefetch_thread(int grid_queue_id, int num_workers, int min_lookahead_jobs,
+                           bool allow_different_solver_binaries, unsigned int min_interval,
+                           unsigned int max_interval, time_t lease_time, int solver_group_budget);
+void stop_prefetch_thread(std::vector<int>& job_ids);
+void prefetch_request(int num_idle_workers, int solver_binary_id, int max_memory_limit);
+int prefetch_release_jobs(int max_memory_limit);
+bool prefetch_begin_update();
+void prefetch_end_update();
+void prefetch_job_finished(double runtime);
+void prefetch_update_jobs(int max_runtime);
+int prefetch_pop_job(PreparedJob& prepared_job, int max_memory_limit, int max_cpus,
+                     const std::map<int, int>& max_cpus_by_grid_queue);
+
+#endif
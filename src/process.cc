@@ -6,11 +6,30 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <vector>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <sched.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <linux/mempolicy.h>
 #include "process.h"
+#include "perfcounters.h"
 #include "log.h"
 
 using namespace std;
 
+// posix_spawn_file_actions_addchdir_np() is available since glibc 2.29
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define HAVE_SPAWN_ADDCHDIR
+#endif
+
+// number of NUMA nodes in the node masks of the memory policies
+#define MAX_NUMA_NODES 1024
+#define BITS_PER_LONG (8 * sizeof(unsigned long))
+
 /**
  * Returns a vector of all process ids associated with the given pid. The first pid in this
  * vector is the given pid itself. The next pids are the pids of the children.
@@ -98,3 +117,285 @@ bool kill_process(pid_t pid, int wait_upto) {
 bool kill_process(pid_t pid) {
 	return kill_process(pid, 2);
 }
+
+/**
+ * Runs <code>command</code> with /bin/sh in the directory <code>working_directory</code> and reads
+ * its standard output. Unlike popen() this doesn't require to change the working directory of the
+ * client and can be used from any thread.
+ * The output is stored in a buffer allocated with malloc() that has to be freed by the caller.
+ *
+ * @param command the command
+ * @param working_directory the working directory of the command
+ * @param output pointer where the output buffer is put
+ * @param output_length pointer where the length of the output is put
+ * @param exit_status pointer where the exit status (as returned by waitpid) is put
+ * @return true on success, false if the command couldn't be started
+ */
+bool run_command(const string& command, const string& working_directory, char** output,
+                 unsigned long* output_length, int* exit_status) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        log_error(AT, "Couldn't create pipe");
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        log_error(AT, "Couldn't fork");
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        // only async-signal-safe functions from here on
+        if (chdir(working_directory.c_str()) != 0 || dup2(fds[1], STDOUT_FILENO) == -1) {
+            _exit(127);
+        }
+        execl("/bin/sh", "sh", "-c", command.c_str(), (char*) NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+
+    unsigned long max_len = 256;
+    unsigned long len = 0;
+    char* buf = (char*) malloc(max_len);
+    ssize_t n_read;
+    while (true) {
+        if (len + 256 >= max_len) {
+            max_len *= 2;
+            buf = (char*) realloc(buf, max_len);
+        }
+        n_read = read(fds[0], buf + len, 256);
+        if (n_read == -1 && errno == EINTR) continue;
+        if (n_read <= 0) break;
+        len += n_read;
+    }
+    buf[len] = '\0';
+    close(fds[0]);
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+    *output = buf;
+    *output_length = len;
+    *exit_status = status;
+    return true;
+}
+
+/**
+ * Looks up the program <code>name</code> in the directories of the PATH variable of
+ * <code>envp</code> like the shell does. Names containing a slash are returned unchanged,
+ * relative paths in PATH are resolved against <code>working_directory</code>.
+ *
+ * @return the path of the program or <code>name</code> if it wasn't found
+ */
+static string find_program(const string& name, const string& working_directory, char** envp) {
+    if (name.find('/') != string::npos) {
+        return name;
+    }
+    string path = "/bin:/usr/bin";
+    for (char** env = envp; env != NULL && *env != NULL; ++env) {
+        if (strncmp(*env, "PATH=", 5) == 0) {
+            path = *env + 5;
+            break;
+        }
+    }
+    size_t start = 0;
+    while (start <= path.length()) {
+        size_t end = path.find(':', start);
+        if (end == string::npos) end = path.length();
+        string dir = path.substr(start, end - start);
+        string program = (dir.empty() ? "." : dir) + "/" + name;
+        string check = program[0] == '/' ? program : working_directory + "/" + program;
+        struct stat st;
+        if (stat(check.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(check.c_str(), X_OK) == 0) {
+            return program;
+        }
+        start = end + 1;
+    }
+    return name;
+}
+
+/**
+ * Creates the child process of spawn_process() and executes <code>path</code> in it. The child
+ * is created with vfork(), or with fork() if a gate pipe is given. This is a separate function
+ * that must not be inlined, so that no local variable of spawn_process() is live across vfork().
+ *
+ * @param gate pipe the child waits on before execve() until the read end returns EOF, -1 for none
+ * @return the pid of the child, -1 on errors
+ */
+static pid_t __attribute__((noinline)) start_child(const char* path, char* const* args, char** envp, const char* directory,
+                         const vector<ResourceLimit>& limits, const char* output, int cgroup_fd, const int gate[2]) {
+    // the child shares the memory of the parent until execve(), so everything it needs
+    // has to be prepared by the caller
+    pid_t pid = gate[0] != -1 ? fork() : vfork();
+    if (pid == 0) {
+        // only async-signal-safe functions from here on. Unless a gate is used, the parent is
+        // suspended until execve(). Errors are signalled with exit code 127 like the shell does.
+        sigset_t empty_mask;
+        sigemptyset(&empty_mask);
+        setpgid(0, 0);
+        sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+        bool ok = chdir(directory) == 0;
+        // writing 0 moves the writing process
+        if (ok && cgroup_fd != -1) {
+            ok = write(cgroup_fd, "0", 1) == 1;
+        }
+        for (unsigned int i = 0; ok && i < limits.size(); i++) {
+            ok = setrlimit(limits[i].resource, &limits[i].limit) == 0;
+        }
+        if (ok && output != NULL) {
+            int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            ok = fd != -1 && dup2(fd, STDOUT_FILENO) != -1 && dup2(fd, STDERR_FILENO) != -1;
+            if (fd > STDERR_FILENO) close(fd);
+        }
+        if (ok && gate[0] != -1) {
+            char c;
+            close(gate[1]);
+            while (read(gate[0], &c, 1) == -1 && errno == EINTR);
+        }
+        if (ok) {
+            execve(path, args, envp);
+        }
+        _exit(127);
+    }
+    return pid;
+}
+
+/**
+ * Starts the program <code>argv[0]</code> with the arguments <code>argv</code> directly, i.e.
+ * without a shell, in the directory <code>working_directory</code>. Like in the shell, a program
+ * name without a slash is searched in PATH. The program runs in its own process group with an
+ * empty signal mask and default signal handlers.
+ * The child is created with posix_spawn(), so unlike fork() the address space of the client isn't
+ * copied. Resource limits and cgroups can't be passed to posix_spawn(), they are set in a child
+ * created with vfork() before execve(). vfork() is also used where
+ * posix_spawn_file_actions_addchdir_np() isn't available.
+ * Performance counters have to be attached to the child before execve(), which the parent can't
+ * do while it is suspended by vfork(). Then the child is created with fork() and waits on a pipe
+ * until the parent attached the counters, see perf_counters_open().
+ * If <code>cpu_ids</code> is not empty, the program is bound to these processing units. Spawn
+ * attributes can't carry a CPU affinity, so the calling thread is bound to them while spawning
+ * and the child inherits the affinity. The affinity of the calling thread is restored afterwards.
+ * In the same way the memory of the program is bound to <code>numa_nodes</code> with the memory
+ * policy MPOL_BIND (see set_mempolicy(2)), so its pages aren't placed on remote nodes.
+ *
+ * @param argv the path or name of the program followed by its arguments
+ * @param working_directory the working directory of the program
+ * @param cpu_ids the processing units the program should be bound to
+ * @param numa_nodes the NUMA nodes the memory of the program should be bound to, empty for no binding
+ * @param envp the environment of the program
+ * @param limits resource limits of the program
+ * @param output_filename file that standard output and error are redirected to, empty to keep them
+ * @param cgroup_fd open cgroup.procs file of the cgroup v2 the program is started in, -1 for none
+ * @param perf_counter_fds vector the file descriptors of the performance counters of the program
+ *        are stored in, NULL to start it without counters
+ * @return the pid of the started process, -1 if the program couldn't be started
+ */
+pid_t spawn_process(const vector<string>& argv, const string& working_directory,
+                    const set<int>& cpu_ids, const set<int>& numa_nodes, char** envp,
+                    const vector<ResourceLimit>& limits,
+                    const string& output_filename, int cgroup_fd, vector<int>* perf_counter_fds) {
+    if (argv.empty()) {
+        return -1;
+    }
+    // execve() doesn't search PATH and execvp() isn't safe after vfork()
+    string program = find_program(argv[0], working_directory, envp);
+    vector<char*> args;
+    for (vector<string>::const_iterator it = argv.begin(); it != argv.end(); ++it) {
+        args.push_back(const_cast<char*>(it->c_str()));
+    }
+    args.push_back(NULL);
+
+    cpu_set_t old_mask;
+    bool pinned = false;
+    if (!cpu_ids.empty()) {
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        for (set<int>::const_iterator it = cpu_ids.begin(); it != cpu_ids.end(); ++it) {
+            CPU_SET(*it, &mask);
+        }
+        if (sched_getaffinity(0, sizeof(old_mask), &old_mask) == 0
+                && sched_setaffinity(0, sizeof(mask), &mask) == 0) {
+            pinned = true;
+        } else {
+            log_error(AT, "Couldn't set CPU affinity: %s", strerror(errno));
+        }
+    }
+
+    int old_mode = MPOL_DEFAULT;
+    unsigned long old_nodes[MAX_NUMA_NODES / BITS_PER_LONG];
+    bool bound = false;
+    if (!numa_nodes.empty()) {
+        unsigned long nodes[MAX_NUMA_NODES / BITS_PER_LONG];
+        memset(nodes, 0, sizeof(nodes));
+        for (set<int>::const_iterator it = numa_nodes.begin(); it != numa_nodes.end(); ++it) {
+            if (*it >= 0 && *it < MAX_NUMA_NODES) {
+                nodes[*it / BITS_PER_LONG] |= 1UL << (*it % BITS_PER_LONG);
+            }
+        }
+        if (syscall(SYS_get_mempolicy, &old_mode, old_nodes, MAX_NUMA_NODES, NULL, 0) == 0
+                && syscall(SYS_set_mempolicy, MPOL_BIND, nodes, MAX_NUMA_NODES + 1) == 0) {
+            bound = true;
+        } else {
+            log_error(AT, "Couldn't set memory policy: %s", strerror(errno));
+        }
+    }
+
+    pid_t pid = -1;
+#ifdef HAVE_SPAWN_ADDCHDIR
+    if (limits.empty() && cgroup_fd == -1 && perf_counter_fds == NULL) {
+        posix_spawnattr_t attr;
+        posix_spawn_file_actions_t file_actions;
+        sigset_t empty_mask, default_signals;
+        sigemptyset(&empty_mask);
+        sigfillset(&default_signals);
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+        posix_spawnattr_setpgroup(&attr, 0);
+        posix_spawnattr_setsigmask(&attr, &empty_mask);
+        posix_spawnattr_setsigdefault(&attr, &default_signals);
+        posix_spawn_file_actions_init(&file_actions);
+        posix_spawn_file_actions_addchdir_np(&file_actions, working_directory.c_str());
+        if (!output_filename.empty()) {
+            posix_spawn_file_actions_addopen(&file_actions, STDOUT_FILENO, output_filename.c_str(),
+                                             O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            posix_spawn_file_actions_adddup2(&file_actions, STDOUT_FILENO, STDERR_FILENO);
+        }
+        int err = posix_spawn(&pid, program.c_str(), &file_actions, &attr, &args[0], envp);
+        if (err != 0) {
+            log_error(AT, "Couldn't start %s in %s: %s", args[0], working_directory.c_str(), strerror(err));
+            pid = -1;
+        }
+        posix_spawn_file_actions_destroy(&file_actions);
+        posix_spawnattr_destroy(&attr);
+    } else
+#endif
+    {
+        // the child waits until the read end returns EOF
+        int gate[2] = {-1, -1};
+        if (perf_counter_fds != NULL && pipe2(gate, O_CLOEXEC) != 0) {
+            log_error(AT, "Couldn't create pipe, starting without performance counters: %s", strerror(errno));
+            gate[0] = gate[1] = -1;
+        }
+        pid = start_child(program.c_str(), &args[0], envp, working_directory.c_str(), limits,
+                          output_filename.empty() ? NULL : output_filename.c_str(), cgroup_fd, gate);
+        if (pid == -1) {
+            log_error(AT, "Couldn't %s: %s", gate[0] != -1 ? "fork" : "vfork", strerror(errno));
+        }
+        if (gate[0] != -1) {
+            if (pid > 0) {
+                perf_counters_open(pid, *perf_counter_fds);
+            }
+            close(gate[0]);
+            close(gate[1]);
+        }
+    }
+
+    if (bound && syscall(SYS_set_mempolicy, old_mode, old_mode == MPOL_DEFAULT ? NULL : old_nodes,
+                         old_mode == MPOL_DEFAULT ? 0 : MAX_NUMA_NODES + 1) != 0) {
+        log_error(AT, "Couldn't restore memory policy: %s", strerror(errno));
+    }
+    if (pinned && sched_setaffinity(0, sizeof(old_mask), &old_mask) != 0) {
+        log_error(AT, "Couldn't restore CPU affinity: %s", strerror(errno));
+    }
+    return pid;
+}
@@ -2,9 +2,28 @@
 #define __process_h__
 
 #include <vector>
+#include <string>
+#include <set>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/**
+ * A resource limit that is set for a process started with spawn_process().
+ */
+struct ResourceLimit {
+    int resource;
+    struct rlimit limit;
+};
 
 bool get_process_pids(pid_t pid, std::vector<pid_t>& children);
 bool kill_process(pid_t pid);
 bool kill_process(pid_t pid, int wait_upto);
+bool run_command(const std::string& command, const std::string& working_directory, char** output,
+                 unsigned long* output_length, int* exit_status);
+pid_t spawn_process(const std::vector<std::string>& argv, const std::string& working_directory,
+                    const std::set<int>& cpu_ids, const std::set<int>& numa_nodes, char** envp,
+                    const std::vector<ResourceLimit>& limits = std::vector<ResourceLimit>(),
+                    const std::string& output_filename = "", int cgroup_fd = -1,
+                    std::vector<int>* perf_counter_fds = NULL);
 
 #endif
@@ -0,0 +1,138 @@
+#include <pthread.h>
+#include <signal.h>
+#include <deque>
+#include <set>
+#include <vector>
+#include "results.h"
+#include "log.h"
+#include "database.h"
+#include "events.h"
+
+using namespace std;
+
+// from client.cc
+extern void finish_job(Job& job, int proc_stat);
+
+/**
+ * A job whose watcher terminated and whose results still have to be processed.
+ */
+class FinishedJob {
+public:
+    Job job;
+    // status of the watcher process as returned by waitpid
+    int proc_stat;
+};
+
+static vector<pthread_t> threads;
+static pthread_mutex_t result_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t result_cond = PTHREAD_COND_INITIALIZER;
+// set when the client exits, the threads finish after the queue is empty
+static bool finishing;
+// set when the client exits without waiting for the queued jobs
+static bool finished;
+
+static deque<FinishedJob> queued_jobs;
+// ids of the jobs that are being processed by the result threads at the moment
+static set<int> processing_job_ids;
+
+/**
+ * A result thread. Takes finished jobs from the queue and processes their results on its own
+ * database connection. The main thread is woken up after each job as the job freed a
+ * core of its experiment.
+ */
+void *result_thread(void*) {
+    // signals are handled by the main thread
+    sigset_t set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    if (!database_connect_thread()) {
+        log_error(AT, "Could not establish database connection for the result thread.");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&result_mutex);
+    while (!finished) {
+        if (queued_jobs.empty()) {
+            if (finishing) break;
+            pthread_cond_wait(&result_cond, &result_mutex);
+            continue;
+        }
+        FinishedJob finished_job = queued_jobs.front();
+        queued_jobs.pop_front();
+        processing_job_ids.insert(finished_job.job.idJob);
+        pthread_mutex_unlock(&result_mutex);
+
+        finish_job(finished_job.job, finished_job.proc_stat);
+
+        pthread_mutex_lock(&result_mutex);
+        processing_job_ids.erase(finished_job.job.idJob);
+        events_notify();
+    }
+    pthread_mutex_unlock(&result_mutex);
+    database_close_thread();
+    return NULL;
+}
+
+/**
+ * Starts the result threads. This method will return immediately after creating the threads.
+ *
+ * @param num_threads the number of jobs whose results are processed at the same time
+ */
+void start_result_threads(int num_threads) {
+    finishing = false;
+    finished = false;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_t thread;
+        pthread_create(&thread, NULL, result_thread, NULL);
+        threads.push_back(thread);
+    }
+    log_message(LOG_INFO, "Started %d result threads.", num_threads);
+}
+
+/**
+ * Stops the result threads.
+ * If <code>wait</code> is set, this method blocks until the results of all queued jobs are
+ * written to the database. Otherwise the ids of the jobs whose results aren't written yet are
+ * returned and have to be reset by the caller.
+ *
+ * @param wait whether to wait for the queued jobs
+ * @param job_ids vector where the ids of the unfinished jobs are put in
+ */
+void stop_result_threads(bool wait, vector<int>& job_ids) {
+    pthread_mutex_lock(&result_mutex);
+    if (wait) {
+        finishing = true;
+        pthread_cond_broadcast(&result_cond);
+        pthread_mutex_unlock(&result_mutex);
+        for (vector<pthread_t>::iterator it = threads.begin(); it != threads.end(); ++it) {
+            pthread_join(*it, NULL);
+        }
+        threads.clear();
+        return;
+    }
+    finished = true;
+    for (deque<FinishedJob>::iterator it = queued_jobs.begin(); it != queued_jobs.end(); ++it) {
+        job_ids.push_back(it->job.idJob);
+    }
+    queued_jobs.clear();
+    job_ids.insert(job_ids.end(), processing_job_ids.begin(), processing_job_ids.end());
+    pthread_cond_broadcast(&result_cond);
+    pthread_mutex_unlock(&result_mutex);
+}
+
+/**
+ * Hands a job whose watcher terminated over to the result threads.
+ *
+ * @param job the job
+ * @param proc_stat the status of the watcher process as returned by waitpid
+ */
+void result_add_job(const Job& job, int proc_stat) {
+    FinishedJob finished_job;
+    finished_job.job = job;
+    finished_job.proc_stat = proc_stat;
+    pthread_mutex_lock(&result_mutex);
+    queued_jobs.push_back(finished_job);
+    pthread_cond_signal(&result_cond);
+    pthread_mutex_unlock(&result_mutex);
+}
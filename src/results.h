@@ -0,0 +1,11 @@
+#ifndef __results_h__
+#define __results_h__
+
+#include <vector>
+#include "datastructures.h"
+
+void start_result_threads(int num_threads);
+void stop_result_threads(bool wait, std::vector<int>& job_ids);
+void result_add_job(const Job& job, int proc_stat);
+
+#endif
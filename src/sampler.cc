@@ -0,0 +1,390 @@
+#include <pthread.h>
+#include <signal.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <ctime>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <vector>
+#include "sampler.h"
+#include "log.h"
+#include "events.h"
+
+using namespace std;
+
+/**
+ * The resource sampler records the memory usage, CPU time, major page faults and I/O of the
+ * running jobs at a fixed interval in one thread for all worker slots. Jobs in cgroups are
+ * sampled from their cgroup files, other jobs from /proc by their process group. Each job
+ * gets a delta encoded trace of bounded size and peak values in its launcher output.
+ */
+
+// maximum number of samples in the trace of a job. When the trace is full, every second
+// sample is dropped and only every second of the following samples is stored.
+const unsigned int MAX_SAMPLES = 512;
+
+struct Sample {
+    // time (ms) since the job was started
+    long long time;
+    // resident memory (KB)
+    long long rss;
+    // CPU time (ms) of the processes of the job including their terminated children
+    long long cpu_time;
+    long long major_faults;
+    long long read_bytes, write_bytes;
+
+    Sample() : time(0), rss(0), cpu_time(0), major_faults(0), read_bytes(0), write_bytes(0) {}
+};
+
+struct SampledJob {
+    pid_t pid;
+    // cgroup of the job, empty if it is sampled from /proc
+    string cgroup;
+    // monotonic time (s) when the job was added
+    double start_time;
+    vector<Sample> samples;
+    // number of samples taken and how many of them are represented by each sample of the trace
+    int count, stride;
+    Sample last;
+    long long peak_rss;
+    double peak_cpu_utilisation, peak_io_rate;
+
+    SampledJob() : pid(0), cgroup(), start_time(0), samples(), count(0), stride(1), last(),
+                   peak_rss(0), peak_cpu_utilisation(0), peak_io_rate(0) {}
+};
+
+static pthread_t thread;
+static pthread_mutex_t sampler_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sampler_cond = PTHREAD_COND_INITIALIZER;
+static bool started = false;
+static bool finished;
+// sampling interval (ms)
+static int sample_interval;
+// the sampled jobs by job id
+static map<int, SampledJob> sampled_jobs;
+// process group of each process in /proc as of the last sample. Only used by the sampler thread,
+// so that only new processes and the processes of the jobs have to be read.
+static map<pid_t, pid_t> process_groups;
+
+/**
+ * Reads the usage of a job from its cgroup. The resident memory is the anonymous and mapped file
+ * memory of memory.stat.
+ *
+ * @return false if cpu.stat couldn't be read
+ */
+static bool read_cgroup_sample(const string& cgroup, Sample& sample) {
+    ifstream cpu_stat((cgroup + "/cpu.stat").c_str());
+    if (!cpu_stat) {
+        return false;
+    }
+    string key;
+    long long value;
+    while (cpu_stat >> key >> value) {
+        if (key == "usage_usec") sample.cpu_time = value / 1000;
+    }
+    ifstream memory_stat((cgroup + "/memory.stat").c_str());
+    while (memory_stat >> key >> value) {
+        if (key == "anon" || key == "file_mapped") sample.rss += value / 1024;
+        else if (key == "pgmajfault") sample.major_faults = value;
+    }
+    ifstream io_stat((cgroup + "/io.stat").c_str());
+    string token;
+    while (io_stat >> token) {
+        if (token.compare(0, 7, "rbytes=") == 0) sample.read_bytes += atoll(token.c_str() + 7);
+        else if (token.compare(0, 7, "wbytes=") == 0) sample.write_bytes += atoll(token.c_str() + 7);
+    }
+    return true;
+}
+
+/**
+ * Reads the process group, resident memory, CPU time and major page faults of a process
+ * from /proc/[pid]/stat.
+ */
+static bool read_process_stat(pid_t pid, pid_t& pgrp, Sample& sample) {
+    char filename[64];
+    snprintf(filename, sizeof(filename), "/proc/%d/stat", pid);
+    FILE* f = fopen(filename, "r");
+    if (f == NULL) {
+        return false;
+    }
+    char buf[1024];
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+    // the command name may contain spaces and parentheses
+    char* fields = strrchr(buf, ')');
+    if (fields == NULL) {
+        return false;
+    }
+    char state;
+    int ppid, group;
+    long long majflt, cmajflt, utime, stime, cutime, cstime, rss;
+    if (sscanf(fields + 2, "%c %d %d %*s %*s %*s %*s %*s %*s %lld %lld %lld %lld %lld %lld %*s %*s %*s %*s %*s %*s %lld",
+               &state, &ppid, &group, &majflt, &cmajflt, &utime, &stime, &cutime, &cstime, &rss) != 10) {
+        return false;
+    }
+    static long ticks = sysconf(_SC_CLK_TCK);
+    static long page_size = sysconf(_SC_PAGESIZE);
+    pgrp = group;
+    sample.rss = rss * (page_size / 1024);
+    sample.cpu_time = (utime + stime + cutime + cstime) * 1000 / ticks;
+    sample.major_faults = majflt + cmajflt;
+    return true;
+}
+
+static void read_process_io(pid_t pid, Sample& sample) {
+    char filename[64];
+    snprintf(filename, sizeof(filename), "/proc/%d/io", pid);
+    FILE* f = fopen(filename, "r");
+    if (f == NULL) {
+        return;
+    }
+    char line[128];
+    long long value;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "read_bytes: %lld", &value) == 1) sample.read_bytes = value;
+        else if (sscanf(line, "write_bytes: %lld", &value) == 1) sample.write_bytes = value;
+    }
+    fclose(f);
+}
+
+/**
+ * Sums the usage of the processes in /proc by process group for the process groups <code>pgrps</code>.
+ * The process group of a process is only read once, it doesn't change for the processes of a job.
+ * Children of the client are read again while they are in the process group of the client, they
+ * may not have called setpgid() yet.
+ */
+static void read_process_samples(const set<pid_t>& pgrps, map<pid_t, Sample>& samples) {
+    DIR* proc_dir = opendir("/proc");
+    if (proc_dir == NULL) {
+        return;
+    }
+    map<pid_t, pid_t> current_groups;
+    pid_t client_pgrp = getpgrp();
+    struct dirent* entry;
+    while ((entry = readdir(proc_dir)) != NULL) {
+        if (!isdigit(entry->d_name[0])) {
+            continue;
+        }
+        pid_t pid = atoi(entry->d_name);
+        map<pid_t, pid_t>::iterator known = process_groups.find(pid);
+        pid_t pgrp;
+        Sample sample;
+        bool have_stat = false;
+        if (known != process_groups.end() && known->second != client_pgrp) {
+            pgrp = known->second;
+        } else if (read_process_stat(pid, pgrp, sample)) {
+            have_stat = true;
+        } else {
+            continue;
+        }
+        current_groups[pid] = pgrp;
+        if (pgrps.count(pgrp) == 0) {
+            continue;
+        }
+        if (!have_stat && !read_process_stat(pid, pgrp, sample)) {
+            continue;
+        }
+        read_process_io(pid, sample);
+        Sample& total = samples[pgrp];
+        total.rss += sample.rss;
+        total.cpu_time += sample.cpu_time;
+        total.major_faults += sample.major_faults;
+        total.read_bytes += sample.read_bytes;
+        total.write_bytes += sample.write_bytes;
+    }
+    closedir(proc_dir);
+    process_groups.swap(current_groups);
+}
+
+/**
+ * Adds a sample to the job: updates the peak values and appends it to the trace.
+ */
+static void add_sample(SampledJob& job, const Sample& sample) {
+    if (job.count > 0) {
+        double elapsed = (sample.time - job.last.time) / 1000.0;
+        if (elapsed > 0) {
+            double cpu_utilisation = (sample.cpu_time - job.last.cpu_time) / 1000.0 / elapsed;
+            double io_rate = (sample.read_bytes + sample.write_bytes - job.last.read_bytes - job.last.write_bytes) / elapsed;
+            if (cpu_utilisation > job.peak_cpu_utilisation) job.peak_cpu_utilisation = cpu_utilisation;
+            if (io_rate > job.peak_io_rate) job.peak_io_rate = io_rate;
+        }
+    }
+    if (sample.rss > job.peak_rss) job.peak_rss = sample.rss;
+    job.last = sample;
+    if (job.count++ % job.stride != 0) {
+        return;
+    }
+    job.samples.push_back(sample);
+    if (job.samples.size() >= MAX_SAMPLES) {
+        for (unsigned int i = 1; 2 * i < job.samples.size(); i++) {
+            job.samples[i] = job.samples[2 * i];
+        }
+        job.samples.resize((job.samples.size() + 1) / 2);
+        job.stride *= 2;
+    }
+}
+
+/**
+ * The sampler thread. The jobs are read without holding the sampler mutex, so starting and
+ * finishing jobs isn't delayed by the sampling.
+ */
+void* sampler_thread(void*) {
+    // signals are handled by the main thread
+    sigset_t set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    double start = monotonic_time();
+
+    pthread_mutex_lock(&sampler_mutex);
+    while (!finished) {
+        // the jobs without their traces
+        map<int, SampledJob> jobs;
+        for (map<int, SampledJob>::iterator it = sampled_jobs.begin(); it != sampled_jobs.end(); ++it) {
+            SampledJob& job = jobs[it->first];
+            job.pid = it->second.pid;
+            job.cgroup = it->second.cgroup;
+            job.start_time = it->second.start_time;
+        }
+        pthread_mutex_unlock(&sampler_mutex);
+
+        double now = monotonic_time();
+        std::set<pid_t> pgrps;
+        for (map<int, SampledJob>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+            if (it->second.cgroup.empty()) pgrps.insert(it->second.pid);
+        }
+        map<pid_t, Sample> process_samples;
+        if (!pgrps.empty()) {
+            read_process_samples(pgrps, process_samples);
+        }
+        map<int, Sample> samples;
+        for (map<int, SampledJob>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+            Sample sample;
+            if (it->second.cgroup.empty()) {
+                if (process_samples.count(it->second.pid) == 0) continue;
+                sample = process_samples[it->second.pid];
+            } else if (!read_cgroup_sample(it->second.cgroup, sample)) {
+                continue;
+            }
+            sample.time = (long long)((now - it->second.start_time) * 1000);
+            samples[it->first] = sample;
+        }
+
+        pthread_mutex_lock(&sampler_mutex);
+        // jobs that finished in the meantime were removed
+        for (map<int, Sample>::iterator it = samples.begin(); it != samples.end(); ++it) {
+            map<int, SampledJob>::iterator job = sampled_jobs.find(it->first);
+            if (job != sampled_jobs.end()) {
+                add_sample(job->second, it->second);
+            }
+        }
+        if (finished) break;
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += sample_interval / 1000;
+        ts.tv_nsec += (sample_interval % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&sampler_cond, &sampler_mutex, &ts);
+    }
+    pthread_mutex_unlock(&sampler_mutex);
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+        double cpu_time = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+                        + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+        double elapsed = monotonic_time() - start;
+        log_message(LOG_INFO, "Resource sampler used %.3f s CPU time in %.0f s (%.4f%% of a CPU).",
+                    cpu_time, elapsed, elapsed > 0 ? cpu_time / elapsed * 100 : 0);
+    }
+    return NULL;
+}
+
+/**
+ * Starts the sampler thread.
+ *
+ * @param interval the sampling interval (ms)
+ */
+void start_sampler_thread(int interval) {
+    sample_interval = interval;
+    finished = false;
+    started = true;
+    pthread_create(&thread, NULL, sampler_thread, NULL);
+    log_message(LOG_INFO, "Started resource sampler, interval %d ms.", interval);
+}
+
+void stop_sampler_thread() {
+    if (!started) {
+        return;
+    }
+    pthread_mutex_lock(&sampler_mutex);
+    finished = true;
+    pthread_cond_signal(&sampler_cond);
+    pthread_mutex_unlock(&sampler_mutex);
+    pthread_join(thread, NULL);
+    started = false;
+}
+
+/**
+ * Starts sampling a job.
+ *
+ * @param job_id the id of the job
+ * @param pid the pid of the job's process, which leads its own process group
+ * @param cgroup the cgroup of the job, empty to sample its process group from /proc
+ */
+void sampler_add_job(int job_id, pid_t pid, const string& cgroup) {
+    SampledJob job;
+    job.pid = pid;
+    job.cgroup = cgroup;
+    job.start_time = monotonic_time();
+    pthread_mutex_lock(&sampler_mutex);
+    sampled_jobs[job_id] = job;
+    pthread_mutex_unlock(&sampler_mutex);
+}
+
+/**
+ * Stops sampling the job and appends its peak values and trace to its launcher output.
+ * Each line of the trace has the differences of the time (ms), resident memory (KB),
+ * CPU time (ms), major page faults, bytes read (KB) and written (KB) to the previous line.
+ *
+ * @param job the job
+ */
+void sampler_remove_job(Job& job) {
+    pthread_mutex_lock(&sampler_mutex);
+    map<int, SampledJob>::iterator it = sampled_jobs.find(job.idJob);
+    if (it == sampled_jobs.end()) {
+        pthread_mutex_unlock(&sampler_mutex);
+        return;
+    }
+    SampledJob sampled_job = it->second;
+    sampled_jobs.erase(it);
+    pthread_mutex_unlock(&sampler_mutex);
+
+    ostringstream oss;
+    oss << endl << "Resource samples:" << endl;
+    oss << setw(30) << "Trace interval (ms): " << sample_interval * sampled_job.stride << endl;
+    oss << setw(30) << "Peak RSS (MB): " << sampled_job.peak_rss / 1024.0 << endl;
+    oss << setw(30) << "Peak CPU utilisation: " << sampled_job.peak_cpu_utilisation << endl;
+    oss << setw(30) << "Peak I/O (bytes/s): " << (long long)sampled_job.peak_io_rate << endl;
+    oss << setw(30) << "Major page faults: " << sampled_job.last.major_faults << endl;
+    oss << "Trace (deltas of time (ms), RSS (KB), CPU time (ms), major faults, read (KB), written (KB)):" << endl;
+    Sample previous;
+    for (vector<Sample>::iterator s = sampled_job.samples.begin(); s != sampled_job.samples.end(); ++s) {
+        oss << s->time - previous.time << ' ' << s->rss - previous.rss << ' '
+            << s->cpu_time - previous.cpu_time << ' ' << s->major_faults - previous.major_faults << ' '
+            << s->read_bytes / 1024 - previous.read_bytes / 1024 << ' '
+            << s->write_bytes / 1024 - previous.write_bytes / 1024 << endl;
+        previous = *s;
+    }
+    job.launcherOutput += oss.str();
+}
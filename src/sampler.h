@@ -0,0 +1,13 @@
+#ifndef __sampler_h__
+#define __sampler_h__
+
+#include <string>
+#include <sys/types.h>
+#include "datastructures.h"
+
+void start_sampler_thread(int interval);
+void stop_sampler_thread();
+void sampler_add_job(int job_id, pid_t pid, const std::string& cgroup);
+void sampler_remove_job(Job& job);
+
+#endif
@@ -8,6 +8,7 @@
 #include <map>
 #include <iostream>
 #include <sstream>
+#include <pthread.h>
 #include "simulate.h"
 #include "log.h"
 #include "database.h"
@@ -16,6 +17,8 @@ using namespace std;
 vector<Job*> jobs;
 map<int,int> status_codes;
 unsigned int current_job;
+// status_codes is updated by the result threads
+static pthread_mutex_t status_codes_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 int simulate_sign_on(int grid_queue) {
     log_message(LOG_IMPORTANT, "Fetching jobs for grid queue id: %d ..", grid_queue);
@@ -33,17 +36,24 @@ bool simulate_choose_experiment(int, Experiment&) {
     return true;
 }
 
-int simulate_db_fetch_job(int, int, int, int, Job& job) {
-    if (current_job >= jobs.size()) {
-        return -1;
+int simulate_db_fetch_jobs(int, int, int, int, int num_jobs, int, int, const LocalResources&, vector<Job>& fetched_jobs) {
+    int num_fetched = 0;
+    while (num_fetched < num_jobs && current_job < jobs.size()) {
+        fetched_jobs.push_back(*(jobs[current_job++]));
+        num_fetched++;
     }
-    job = *(jobs[current_job++]);
-    return job.idJob;
+    return num_fetched;
+}
+
+int simulate_db_update_start_time(int) {
+    return 1;
 }
 
 int simulate_db_update_job(const Job& j) {
+    pthread_mutex_lock(&status_codes_mutex);
     if (j.status != 0)
         status_codes[j.status]++;
+    pthread_mutex_unlock(&status_codes_mutex);
     return 1;
 }
 
@@ -76,8 +86,9 @@ void initialize_simulation(Methods &methods) {
     methods.sign_on = simulate_sign_on;
     methods.sign_off = simulate_sign_off;
     methods.choose_experiment = simulate_choose_experiment;
-    methods.db_fetch_job = simulate_db_fetch_job;
+    methods.db_fetch_jobs = simulate_db_fetch_jobs;
     methods.db_update_job = simulate_db_update_job;
+    methods.db_update_start_time = simulate_db_update_start_time;
     methods.increment_core_count = simulate_increment_core_count;
 }
 
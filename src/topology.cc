@@ -0,0 +1,266 @@
+#include <sched.h>
+#include <dirent.h>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "topology.h"
+#include "log.h"
+
+using namespace std;
+
+/**
+ * CPU topology from /sys/devices/system/cpu. The PUs are ordered by package, NUMA node,
+ * L3 cache, core and SMT thread so that neighbouring entries share as many resources as possible.
+ */
+
+static const char* CPU_SYSFS_PATH = "/sys/devices/system/cpu";
+
+static int read_int_file(const string& filename, int default_value) {
+    ifstream f(filename.c_str());
+    int value;
+    if (f >> value) {
+        return value;
+    }
+    return default_value;
+}
+
+/**
+ * Parses a CPU list like "0-3,8,10-11".
+ */
+static void parse_cpu_list(const string& list, vector<int>& cpus) {
+    istringstream iss(list);
+    string range;
+    while (getline(iss, range, ',')) {
+        int first, last;
+        int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (n == 1) {
+            cpus.push_back(first);
+        } else if (n == 2) {
+            for (int i = first; i <= last; i++) cpus.push_back(i);
+        }
+    }
+}
+
+/**
+ * Returns the id of the L3 cache of <code>cpu</code>. Kernels that don't provide the cache
+ * id use the first CPU sharing the cache instead. Returns -1 if the CPU has no L3 cache.
+ */
+static int read_l3_cache_id(int cpu) {
+    for (int index = 0; ; index++) {
+        ostringstream path;
+        path << CPU_SYSFS_PATH << "/cpu" << cpu << "/cache/index" << index;
+        int level = read_int_file(path.str() + "/level", -1);
+        if (level == -1) {
+            return -1;
+        }
+        if (level != 3) {
+            continue;
+        }
+        int id = read_int_file(path.str() + "/id", -1);
+        if (id == -1) {
+            ifstream f((path.str() + "/shared_cpu_list").c_str());
+            string list;
+            vector<int> shared;
+            if (f >> list) parse_cpu_list(list, shared);
+            id = shared.empty() ? -1 : shared[0];
+        }
+        return id;
+    }
+}
+
+/**
+ * Returns the NUMA node of <code>cpu</code>, the directory of the CPU links to it as nodeN.
+ * Returns -1 if the kernel has no NUMA support.
+ */
+static int read_numa_node(int cpu) {
+    ostringstream path;
+    path << CPU_SYSFS_PATH << "/cpu" << cpu;
+    DIR* dir = opendir(path.str().c_str());
+    if (dir == NULL) {
+        return -1;
+    }
+    int node = -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "node", 4) == 0 && isdigit(entry->d_name[4])) {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+static bool compare_pus(const ProcessingUnit& a, const ProcessingUnit& b) {
+    if (a.package != b.package) return a.package < b.package;
+    if (a.node != b.node) return a.node < b.node;
+    if (a.l3_cache != b.l3_cache) return a.l3_cache < b.l3_cache;
+    if (a.core != b.core) return a.core < b.core;
+    if (a.thread != b.thread) return a.thread < b.thread;
+    return a.id < b.id;
+}
+
+/**
+ * Reads the topology of the PUs the client may run on (its CPU affinity, which also
+ * reflects cpusets of the batch system) in topological order.
+ *
+ * @param pus vector the PUs are stored in
+ * @return true on success
+ */
+bool topology_read(vector<ProcessingUnit>& pus) {
+    cpu_set_t mask;
+    if (sched_getaffinity(0, sizeof(mask), &mask) != 0) {
+        log_error(AT, "Could not determine the CPU affinity of the client");
+        return false;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &mask)) {
+            continue;
+        }
+        ostringstream path;
+        path << CPU_SYSFS_PATH << "/cpu" << cpu << "/topology";
+        ProcessingUnit pu;
+        pu.id = cpu;
+        pu.package = read_int_file(path.str() + "/physical_package_id", -1);
+        pu.node = read_numa_node(cpu);
+        pu.core = read_int_file(path.str() + "/core_id", cpu);
+        pu.l3_cache = read_l3_cache_id(cpu);
+        pu.thread = 0;
+        ifstream f((path.str() + "/thread_siblings_list").c_str());
+        string list;
+        vector<int> siblings;
+        if (f >> list) parse_cpu_list(list, siblings);
+        for (int i = 0; i < (int)siblings.size(); i++) {
+            if (siblings[i] == cpu) pu.thread = i;
+        }
+        pus.push_back(pu);
+    }
+    sort(pus.begin(), pus.end(), compare_pus);
+    return !pus.empty();
+}
+
+static int group_key(const ProcessingUnit& pu, int level) {
+    switch (level) {
+    case 0: return pu.package;
+    case 1: return pu.node;
+    case 2: return pu.l3_cache;
+    case 3: return pu.core;
+    default: return pu.id;
+    }
+}
+
+/**
+ * Distributes <code>count</code> PUs evenly over the groups of <code>level</code>
+ * (package, NUMA node, L3 cache, core, PU) and recursively over their subgroups.
+ */
+static void distribute_pus(const vector<ProcessingUnit>& pus, int level, int count, vector<int>& pu_ids) {
+    if (count <= 0 || pus.empty()) {
+        return;
+    }
+    if (level > 4) {
+        return;
+    }
+    vector<vector<ProcessingUnit> > groups;
+    for (vector<ProcessingUnit>::const_iterator it = pus.begin(); it != pus.end(); ++it) {
+        if (groups.empty() || group_key(groups.back()[0], level) != group_key(*it, level)) {
+            groups.push_back(vector<ProcessingUnit>());
+        }
+        groups.back().push_back(*it);
+    }
+    // even shares, the remainder goes to the first groups. Groups that are too small
+    // pass the rest of their share on to the following groups.
+    vector<int> shares(groups.size(), count / groups.size());
+    for (unsigned int i = 0; i < count % groups.size(); i++) shares[i]++;
+    int carry = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (unsigned int i = 0; i < groups.size(); i++) {
+            shares[i] += carry;
+            carry = 0;
+            if (shares[i] > (int)groups[i].size()) {
+                carry = shares[i] - groups[i].size();
+                shares[i] = groups[i].size();
+            }
+        }
+    }
+    for (unsigned int i = 0; i < groups.size(); i++) {
+        if (level == 4) {
+            if (shares[i] > 0) pu_ids.push_back(groups[i][0].id);
+        } else {
+            distribute_pus(groups[i], level + 1, shares[i], pu_ids);
+        }
+    }
+}
+
+static const char* POLICY_NAMES[] = {"spread", "core", "scatter", "compact"};
+
+/**
+ * Selects <code>count</code> of the PUs according to <code>policy</code>. With PLACEMENT_SPREAD and
+ * PLACEMENT_SCATTER they are spread evenly over packages, NUMA nodes, caches and cores, so that SMT
+ * siblings are only used if there are more PUs requested than cores. PLACEMENT_CORE does the same
+ * with the first PU of each core only and selects fewer PUs if there are less cores than requested.
+ * PLACEMENT_COMPACT takes the first PUs. The selected PUs are returned in topological order.
+ *
+ * @param pus the PUs in topological order, see topology_read()
+ * @param count number of PUs to select
+ * @param policy the placement policy
+ * @param pu_ids vector the OS indices of the selected PUs are stored in
+ */
+void topology_select_pus(const vector<ProcessingUnit>& pus, int count, PlacementPolicy policy, vector<int>& pu_ids) {
+    count = min(count, (int)pus.size());
+    if (policy == PLACEMENT_COMPACT) {
+        for (int i = 0; i < count; i++) {
+            pu_ids.push_back(pus[i].id);
+        }
+    } else if (policy == PLACEMENT_CORE) {
+        vector<ProcessingUnit> first_pus;
+        for (unsigned int i = 0; i < pus.size(); i++) {
+            if (i == 0 || pus[i].package != pus[i - 1].package || pus[i].core != pus[i - 1].core) {
+                first_pus.push_back(pus[i]);
+            }
+        }
+        distribute_pus(first_pus, 0, min(count, (int)first_pus.size()), pu_ids);
+    } else {
+        distribute_pus(pus, 0, count, pu_ids);
+    }
+}
+
+/**
+ * Returns the number of physical cores of the PUs.
+ *
+ * @param pus the PUs in topological order, see topology_read()
+ */
+int topology_count_cores(const vector<ProcessingUnit>& pus) {
+    int cores = 0;
+    for (unsigned int i = 0; i < pus.size(); i++) {
+        if (i == 0 || pus[i].package != pus[i - 1].package || pus[i].core != pus[i - 1].core) {
+            cores++;
+        }
+    }
+    return cores;
+}
+
+/**
+ * Parses the name of a placement policy (spread, core, scatter or compact).
+ *
+ * @param name the name
+ * @param policy where the policy is stored
+ * @return false if the name is unknown
+ */
+bool topology_parse_policy(const string& name, PlacementPolicy& policy) {
+    for (int i = 0; i < (int)(sizeof(POLICY_NAMES) / sizeof(POLICY_NAMES[0])); i++) {
+        if (name == POLICY_NAMES[i]) {
+            policy = (PlacementPolicy)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* topology_policy_name(PlacementPolicy policy) {
+    return POLICY_NAMES[policy];
+}
@@ -0,0 +1,43 @@
+#ifndef __topology_h__
+#define __topology_h__
+
+#include <vector>
+#include <string>
+
+/**
+ * A processing unit (logical CPU) and its position in the CPU topology.
+ */
+struct ProcessingUnit {
+    // OS index of the PU as used by sched_setaffinity
+    int id;
+    // physical package (socket), NUMA node, shared L3 cache and core the PU belongs to, -1 if unknown
+    int package;
+    int node;
+    int l3_cache;
+    int core;
+    // position of the PU among the SMT siblings of its core
+    int thread;
+};
+
+/**
+ * How the PUs of the grid queue are selected and assigned to the jobs.
+ */
+enum PlacementPolicy {
+    // spread over packages, NUMA nodes, caches and cores, SMT siblings only if there are more CPUs than cores
+    PLACEMENT_SPREAD,
+    // one PU per physical core, SMT siblings stay idle
+    PLACEMENT_CORE,
+    // like PLACEMENT_SPREAD, jobs are started in the L3 cache domain with the fewest running jobs
+    PLACEMENT_SCATTER,
+    // the first PUs in topological order, SMT siblings and caches are filled up before the next ones are used
+    PLACEMENT_COMPACT
+};
+
+bool topology_read(std::vector<ProcessingUnit>& pus);
+void topology_select_pus(const std::vector<ProcessingUnit>& pus, int count, PlacementPolicy policy,
+                         std::vector<int>& pu_ids);
+int topology_count_cores(const std::vector<ProcessingUnit>& pus);
+bool topology_parse_policy(const std::string& name, PlacementPolicy& policy);
+const char* topology_policy_name(PlacementPolicy policy);
+
+#endif
@@ -0,0 +1,204 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <sstream>
+#include "watcher.h"
+#include "log.h"
+
+using namespace std;
+
+// time (s) between the soft and the hard CPU time limit, the hard limit sends SIGKILL
+const int CPU_TIME_HARD_LIMIT_MARGIN = 2;
+
+/**
+ * Built-in replacement for runsolver. The solver is started directly by the client with
+ * resource limits and the client enforces the limits on the whole process group of the
+ * solver. The results are taken from the rusage of wait4() and written to the job without
+ * any watcher output file.
+ */
+
+static double timeval_to_seconds(const struct timeval& tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void add_limit(vector<ResourceLimit>& limits, int resource, rlim_t soft, rlim_t hard) {
+    ResourceLimit limit;
+    limit.resource = resource;
+    limit.limit.rlim_cur = soft;
+    limit.limit.rlim_max = hard;
+    limits.push_back(limit);
+}
+
+/**
+ * Determines the resource limits the solver process of <code>job</code> is started with.
+ * Limits of -1 aren't imposed. Core dumps are always disabled.
+ *
+ * @param job the job
+ * @param limits vector the limits are appended to
+ */
+void watcher_get_limits(const Job& job, vector<ResourceLimit>& limits) {
+    if (job.CPUTimeLimit > 0) {
+        add_limit(limits, RLIMIT_CPU, job.CPUTimeLimit, job.CPUTimeLimit + CPU_TIME_HARD_LIMIT_MARGIN);
+    }
+    if (job.memoryLimit > 0) {
+        rlim_t bytes = (rlim_t)job.memoryLimit * 1024 * 1024;
+        add_limit(limits, RLIMIT_AS, bytes, bytes);
+    }
+    if (job.stackSizeLimit > 0) {
+        rlim_t bytes = (rlim_t)job.stackSizeLimit * 1024 * 1024;
+        add_limit(limits, RLIMIT_STACK, bytes, bytes);
+    }
+    add_limit(limits, RLIMIT_CORE, 0, 0);
+}
+
+/**
+ * Reads the CPU time and virtual memory size of all processes from /proc and sums
+ * them up by process group. /proc is only scanned once for all jobs.
+ *
+ * @param usage map where the usage is stored by process group id
+ */
+void watcher_get_usage(map<pid_t, ProcessGroupUsage>& usage) {
+    DIR* proc_dir = opendir("/proc");
+    if (proc_dir == NULL) {
+        log_error(AT, "Could not open /proc");
+        return;
+    }
+    double ticks = sysconf(_SC_CLK_TCK);
+    struct dirent* process_dir;
+    while ((process_dir = readdir(proc_dir)) != NULL) {
+        if (!isdigit(process_dir->d_name[0])) {
+            continue;
+        }
+        string filename = string("/proc/") + process_dir->d_name + "/stat";
+        FILE* stat_file = fopen(filename.c_str(), "r");
+        if (stat_file == NULL) {
+            continue;
+        }
+        char buf[1024];
+        size_t len = fread(buf, 1, sizeof(buf) - 1, stat_file);
+        fclose(stat_file);
+        buf[len] = '\0';
+        // the command name may contain spaces and parentheses, the fields start after the last ')'
+        char* fields = strrchr(buf, ')');
+        if (fields == NULL) {
+            continue;
+        }
+        char state;
+        int ppid, pgrp;
+        unsigned long utime, stime, vsize;
+        long cutime, cstime;
+        if (sscanf(fields + 1, " %c %d %d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld %*d %*d %*d %*d %*u %lu",
+                   &state, &ppid, &pgrp, &utime, &stime, &cutime, &cstime, &vsize) != 8) {
+            continue;
+        }
+        // children that were already waited for are counted in cutime and cstime of their parent
+        ProcessGroupUsage& group = usage[pgrp];
+        group.cpu_time += (utime + stime + cutime + cstime) / ticks;
+        group.vsize += vsize;
+    }
+    closedir(proc_dir);
+}
+
+/**
+ * Checks whether <code>job</code> exceeded one of its limits.
+ *
+ * @param job the job
+ * @param wall_time the time (s) since the job was started
+ * @param usage the resource usage of the process group of the job, NULL to check the wall clock limit only
+ * @return the status of the exceeded limit (21 CPU time, 22 wall clock time, 23 memory), 0 if none was exceeded
+ */
+int watcher_check_limits(const Job& job, double wall_time, const ProcessGroupUsage* usage) {
+    if (job.wallClockTimeLimit > 0 && wall_time >= job.wallClockTimeLimit) {
+        return 22;
+    }
+    if (usage == NULL) {
+        return 0;
+    }
+    if (job.CPUTimeLimit > 0 && usage->cpu_time >= job.CPUTimeLimit) {
+        return 21;
+    }
+    if (job.memoryLimit > 0 && usage->vsize > (unsigned long long)job.memoryLimit * 1024 * 1024) {
+        return 23;
+    }
+    return 0;
+}
+
+/**
+ * Sets the status, result code, times and watcher output of a job whose solver process
+ * terminated. The output uses the same lines as runsolver for the values the client reads.
+ *
+ * @param job the job
+ * @param proc_stat status of the solver process as returned by wait4()
+ * @param usage resource usage of the solver process and its children as returned by wait4()
+ * @param wall_time the time (s) the solver ran
+ * @param sampled_cpu_time the last CPU time (s) of the process group, see watcher_get_usage(). It includes
+ *        processes that were killed with the solver and never waited for.
+ * @param exceeded_limit the limit the job was killed for, see watcher_check_limits()
+ */
+void watcher_set_results(Job& job, int proc_stat, const struct rusage& usage, double wall_time,
+                         double sampled_cpu_time, int exceeded_limit) {
+    double user_time = timeval_to_seconds(usage.ru_utime);
+    double system_time = timeval_to_seconds(usage.ru_stime);
+    job.resultTime = user_time + system_time;
+    if (sampled_cpu_time > job.resultTime) {
+        job.resultTime = sampled_cpu_time;
+    }
+    job.wallTime = wall_time;
+    job.watcherExitCode = 0;
+    job.resultCode = 0; // default result code is unknown
+
+    ostringstream out;
+    out << "Built-in watcher of the EDACC client" << endl;
+    out << "Limits: CPU time " << job.CPUTimeLimit << " s, wall clock time " << job.wallClockTimeLimit
+        << " s, memory " << job.memoryLimit << " MB, stack " << job.stackSizeLimit << " MB" << endl << endl;
+    if (exceeded_limit == 21) {
+        out << "Maximum CPU time exceeded: sending SIGTERM then SIGKILL" << endl;
+    } else if (exceeded_limit == 22) {
+        out << "Maximum wall clock time exceeded: sending SIGTERM then SIGKILL" << endl;
+    } else if (exceeded_limit == 23) {
+        out << "Maximum VSize exceeded: sending SIGTERM then SIGKILL" << endl;
+    }
+
+    if (exceeded_limit != 0) {
+        job.status = exceeded_limit;
+        job.resultCode = -exceeded_limit;
+    } else if (WIFSIGNALED(proc_stat)) {
+        int signal = WTERMSIG(proc_stat);
+        out << "Child ended because it received signal " << signal << " (" << strsignal(signal) << ")" << endl;
+        if (signal == SIGXCPU) {
+            job.status = 21;
+            job.resultCode = -21;
+        } else {
+            job.status = -3;
+            job.resultCode = -(300 + signal);
+        }
+    } else {
+        job.solverExitCode = WEXITSTATUS(proc_stat);
+        out << "Child status: " << job.solverExitCode << endl;
+        if (job.solverExitCode == 126) {
+            job.status = -3;
+            job.resultCode = -398;
+        } else if (job.solverExitCode == 127) {
+            job.status = -3;
+            job.resultCode = -399;
+        } else {
+            job.status = 1;
+        }
+    }
+    out << "Real time (s): " << wall_time << endl;
+    out << "CPU time (s): " << job.resultTime << endl;
+    out << "CPU user time (s): " << user_time << endl;
+    out << "CPU system time (s): " << system_time << endl;
+    out << "Max. resident set size (KiB): " << usage.ru_maxrss << endl;
+    out << "Page faults: " << usage.ru_majflt << " major, " << usage.ru_minflt << " minor" << endl;
+    out << "Context switches: " << usage.ru_nvcsw << " voluntary, " << usage.ru_nivcsw << " involuntary" << endl;
+    job.watcherOutput = out.str();
+
+    log_message(LOG_IMPORTANT, "[Job %d] CPUTime: %f", job.idJob, job.resultTime);
+    log_message(LOG_IMPORTANT, "[Job %d] wall time: %f", job.idJob, job.wallTime);
+}
@@ -0,0 +1,29 @@
+#ifndef __watcher_h__
+#define __watcher_h__
+
+#include <vector>
+#include <map>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include "datastructures.h"
+#include "process.h"
+
+/**
+ * Resource usage of all processes of a process group.
+ */
+struct ProcessGroupUsage {
+    // CPU time (s) of the processes and of their terminated children
+    double cpu_time;
+    // virtual memory size (bytes)
+    unsigned long long vsize;
+
+    ProcessGroupUsage() : cpu_time(0), vsize(0) {}
+};
+
+void watcher_get_limits(const Job& job, std::vector<ResourceLimit>& limits);
+void watcher_get_usage(std::map<pid_t, ProcessGroupUsage>& usage);
+int watcher_check_limits(const Job& job, double wall_time, const ProcessGroupUsage* usage);
+void watcher_set_results(Job& job, int proc_stat, const struct rusage& usage, double wall_time,
+                         double sampled_cpu_time, int exceeded_limit);
+
+#endif